@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/** Memory for objects that are all freed together.
+ *
+ * An Arena hands out memory from a block, front to back, and frees none of
+ * it before the Arena itself is destroyed.  Allocating is a pointer bump,
+ * and objects that are allocated after each other lie next to each other.
+ * When the block is full, it continues in a new block of twice the size.
+ *
+ * Objects made with create() are destroyed with the Arena, newest first.
+ * Containers can allocate from an Arena with an ArenaAllocator.  An Arena is
+ * not thread-safe.
+ */
+class Arena {
+  public:
+    /** Reserve a first block of capacity bytes; 0 waits until it is needed. */
+    explicit Arena(size_t capacity = 0) {
+      if (capacity > 0) {
+        grow(capacity);
+      }
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+      for (Finalizer* finalizer = finalizers_; finalizer; finalizer = finalizer->next) {
+        finalizer->destroy(finalizer->object);
+      }
+      while (blocks_) {
+        Block* next = blocks_->next;
+        ::operator delete(blocks_);
+        blocks_ = next;
+      }
+    }
+
+    /** size bytes, aligned to alignment, which must be a power of two. */
+    void* allocate(size_t size, size_t alignment) {
+      size_t padding = (alignment - reinterpret_cast<uintptr_t>(position_) % alignment) % alignment;
+      if (!blocks_ || size + padding > static_cast<size_t>(end_ - position_)) {
+        grow(size + alignment);
+        padding = (alignment - reinterpret_cast<uintptr_t>(position_) % alignment) % alignment;
+      }
+      char* memory = position_ + padding;
+      position_ = memory + size;
+      size_ += padding + size;
+      return memory;
+    }
+
+    /** Construct a T in the Arena.  It is destroyed with the Arena. */
+    template<class T, class... Args>
+    T* create(Args&&... args) {
+      if (std::is_trivially_destructible<T>::value) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      }
+      Finalizer* finalizer = new (allocate(sizeof(Finalizer), alignof(Finalizer))) Finalizer;
+      T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      finalizer->destroy = &destroy<T>;
+      finalizer->object = object;
+      finalizer->next = finalizers_;
+      finalizers_ = finalizer;
+      return object;
+    }
+
+    /** An upper bound of the bytes that create<T>() takes. */
+    template<class T>
+    static constexpr size_t objectSpace() {
+      return sizeof(T) + alignof(T) - 1
+        + (std::is_trivially_destructible<T>::value ? 0 : sizeof(Finalizer) + alignof(Finalizer) - 1);
+    }
+
+    /** An upper bound of the bytes that an array of count Ts takes. */
+    template<class T>
+    static constexpr size_t arraySpace(size_t count) {
+      return count == 0 ? 0 : count * sizeof(T) + alignof(T) - 1;
+    }
+
+    /** Bytes handed out so far, including padding. */
+    size_t getSize() const { return size_; }
+    /** Bytes in all blocks together. */
+    size_t getCapacity() const { return capacity_; }
+    size_t getBlockCount() const { return block_count_; }
+
+  private:
+    struct Block {
+      Block* next;
+      size_t size;
+    };
+
+    struct Finalizer {
+      Finalizer* next;
+      void (*destroy)(void*);
+      void* object;
+    };
+
+    Block* blocks_ = nullptr;
+    char* position_ = nullptr;
+    char* end_ = nullptr;
+    Finalizer* finalizers_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    size_t block_count_ = 0;
+
+    template<class T>
+    static void destroy(void* object) {
+      static_cast<T*>(object)->~T();
+    }
+
+    void grow(size_t minimum) {
+      size_t size = blocks_ ? 2 * blocks_->size : 0;
+      if (size < minimum) {
+        size = minimum;
+      }
+      // The data follows the Block; allocate() aligns within it.
+      Block* block = static_cast<Block*>(::operator new(sizeof(Block) + size));
+      block->next = blocks_;
+      block->size = size;
+      blocks_ = block;
+      position_ = reinterpret_cast<char*>(block + 1);
+      end_ = position_ + size;
+      capacity_ += size;
+      ++block_count_;
+    }
+};
+
+/** An allocator that takes memory from an Arena.
+ *
+ * Without an Arena it allocates on the heap, like std::allocator, so the
+ * same container type serves both.  Copies of a container allocate on the
+ * heap, so that they do not depend on the Arena.
+ */
+template<class T>
+class ArenaAllocator {
+  public:
+    using value_type = T;
+
+    ArenaAllocator() = default;
+    explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.getArena()) {}
+
+    T* allocate(size_t count) {
+      if (arena_) {
+        return static_cast<T*>(arena_->allocate(count * sizeof(T), alignof(T)));
+      }
+      return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, size_t) {
+      if (!arena_) {
+        ::operator delete(pointer);
+      }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const {
+      return ArenaAllocator();
+    }
+
+    Arena* getArena() const { return arena_; }
+
+  private:
+    Arena* arena_ = nullptr;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.getArena() == b.getArena();
+}
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return !(a == b);
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Consideration.h"
+#include "Exceptions.h"
+
+/** A UtilityFunction that computes its value on a background thread.
+ *
+ * Reading an AsyncUtility never waits for its function.  It returns the
+ * last value that was completed, and asks the background thread for a new
+ * one if it is idle.  So a slow query, like a path-planner call, lags a
+ * tick or more behind instead of stalling getBestDecision.  The age of a
+ * value is measured from the moment its computation started.  A Penalty
+ * may adjust values as they grow old, see fadeTo().
+ *
+ * An AsyncUtility can be used wherever a UtilityFunction is, also as the
+ * function of an InputChannel or in input_consideration.  Copies share the
+ * same thread and value; the thread stops when the last copy is gone.  The
+ * function runs on another thread than the engine, so it should only read
+ * state that is safe to read concurrently.  If it throws, the previous
+ * value is kept.
+ */
+class AsyncUtility {
+  public:
+    using Clock = std::chrono::steady_clock;
+    /** Maps a value and its age to the value that is returned. */
+    using Penalty = std::function<float(float, Clock::duration)>;
+
+    /** Start the background thread.
+     *
+     * Until the first value is completed, reads return initial.
+     */
+    explicit AsyncUtility(const UtilityFunction& function,
+        float initial = 0.f,
+        const Penalty& penalty = Penalty())
+      : worker_(std::make_shared<Worker>(function, initial)),
+      penalty_(penalty)
+    {}
+
+    /** The last completed value, after the Penalty. */
+    float operator()() const {
+      float value;
+      Clock::duration age;
+      if (!worker_->read(value, age)) {
+        return value;
+      }
+      return penalty_ ? penalty_(value, age) : value;
+    }
+
+    /** Time since the computation of the last value started, or
+     *  Clock::duration::max() if there is no value yet. */
+    Clock::duration getAge() const {
+      float value;
+      Clock::duration age;
+      return worker_->peek(value, age) ? age : Clock::duration::max();
+    }
+
+    bool hasValue() const {
+      float value;
+      Clock::duration age;
+      return worker_->peek(value, age);
+    }
+
+    /** A Penalty that moves values linearly to fallback as they age.
+     *
+     * A fresh value is returned as is; a value of horizon or older is
+     * replaced by fallback.
+     */
+    static Penalty fadeTo(float fallback, Clock::duration horizon) {
+      return [fallback, horizon](float value, Clock::duration age) {
+        if (age >= horizon) {
+          return fallback;
+        }
+        const float weight = std::chrono::duration<float>(age).count()
+          / std::chrono::duration<float>(horizon).count();
+        return value + weight * (fallback - value);
+      };
+    }
+
+  private:
+    /** The background thread and the value it shares with the readers. */
+    class Worker {
+      public:
+        Worker(const UtilityFunction& function, float initial)
+          : function_(function),
+          value_(initial)
+        {
+          thread_ = std::thread([this]() { run(); });
+        }
+
+        Worker(const Worker&) = delete;
+        Worker& operator=(const Worker&) = delete;
+
+        ~Worker() {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+          }
+          wake_.notify_one();
+          thread_.join();
+        }
+
+        /** Get the last value and ask for a new one.  Returns false if
+         *  there is no completed value yet. */
+        bool read(float& value, Clock::duration& age) {
+          bool wake;
+          bool completed;
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            completed = get(value, age);
+            wake = !requested_;
+            requested_ = true;
+          }
+          if (wake) {
+            wake_.notify_one();
+          }
+          return completed;
+        }
+
+        /** Get the last value without asking for a new one. */
+        bool peek(float& value, Clock::duration& age) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          return get(value, age);
+        }
+
+      private:
+        UtilityFunction function_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        bool requested_ = false;
+        bool stopping_ = false;
+        bool completed_ = false;
+        float value_;
+        Clock::time_point started_;
+        std::thread thread_;
+
+        bool get(float& value, Clock::duration& age) const {
+          value = value_;
+          age = Clock::now() - started_;
+          return completed_;
+        }
+
+        void run() {
+          std::unique_lock<std::mutex> lock(mutex_);
+          for (;;) {
+            wake_.wait(lock, [this]() { return stopping_ || requested_; });
+            if (stopping_) {
+              return;
+            }
+            lock.unlock();
+            const Clock::time_point started = Clock::now();
+            float value = 0.f;
+            bool computed = true;
+#if BEHAVIOR_ENGINE_EXCEPTIONS
+            try {
+              value = function_();
+            } catch (...) {
+              // Keep the previous value, and try again on the next read.
+              computed = false;
+            }
+#else
+            value = function_();
+#endif
+            lock.lock();
+            if (computed) {
+              value_ = value;
+              started_ = started;
+              completed_ = true;
+            }
+            requested_ = false;
+          }
+        }
+    };
+
+    std::shared_ptr<Worker> worker_;
+    Penalty penalty_;
+};
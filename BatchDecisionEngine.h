@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include "Consideration.h"
+#include "Decision.h"
+#include "DecisionEngine.h"
+#include "Exceptions.h"
+#include "InputChannel.h"
+#include "Profile.h"
+
+/** Selects the best Decision for many agents that share one rule set.
+ *
+ * Where a DecisionEngine holds the rules of one agent, the
+ * BatchDecisionEngine holds a single copy of the rules, and keeps the state
+ * of each agent (raised events, loaded Decisions, execution timestamps and
+ * last scores) in flat arrays indexed by decision and agent.
+ * getBestDecisions() walks the rules once, ordered by UtilityScore, and
+ * scores every agent that still can be improved by the current Decision.
+ * Each Consideration is evaluated for all those agents in one go, so its
+ * spline runs through the batch kernels of Spline::evaluate().
+ *
+ * Considerations and Actions are shared by all agents, so they should read
+ * the agent they are working for through getAgent():
+ *
+ *     consideration(description("Distance to ball"), range(0, 9000),
+ *         Spline::Linear({{0, 1}, {1, 0}}), {
+ *           return robots[getAgent()].ballDistance;
+ *         })
+ *
+ * An Input (see InputChannel) holds one value per tick, not per agent, so
+ * addDecision rejects Considerations that read one.  A Decision that is
+ * given a scorer with Decision::setScorer is scored through it, one agent
+ * at a time.  The others are scored in the order of their Considerations,
+ * so Decision::setAdaptiveOrdering has no effect here.
+ */
+class BatchDecisionEngine {
+  public:
+    using Clock = Decision::Clock;
+
+    explicit BatchDecisionEngine(size_t agent_count = 0) {
+      resize(agent_count);
+    }
+
+    /** Number of agents that are scored by getBestDecisions(). */
+    size_t size() const { return agents; }
+
+    /** Change the number of agents.
+     *
+     * Existing agents keep their state, new agents start without any raised
+     * Event.
+     */
+    void resize(size_t n) {
+      if (n == agents) {
+        return;
+      }
+      relayout(active_events, event_decisions.size(), n, uint8_t(0));
+      relayout(active_counts, decisions.size(), n, 0u);
+      relayout(execution_timestamps, decisions.size(), n, Clock::time_point());
+      relayout(last_scores, decisions.size(), n, 0.f);
+      agents = n;
+      highest_scores.assign(agents, 0.f);
+      best_decisions.assign(agents, NO_DECISION);
+      finished.assign(agents, 0);
+      candidates.assign(agents, 0);
+      live.assign(agents, 0);
+      totals.assign(agents, 0.f);
+      inputs.assign(agents, 0.f);
+      outputs.assign(agents, 0.f);
+    }
+
+    /** Add a new Decision to the shared rules.
+     *
+     * Agents that have raised any of the events load the new Decision
+     * immediately.  Throws std::invalid_argument if a Consideration reads
+     * an Input.
+     */
+    void addDecision(const name& n,
+        const description& d,
+        UtilityScore u,
+        events e,
+        considerations c,
+        const Action& a)
+    {
+      for (const Consideration& consideration : c) {
+        if (consideration.getUtilityFunction().target<Input>()) {
+          BEHAVIOR_ENGINE_THROW(std::invalid_argument(
+                "An Input has no value per agent: " + consideration.getDescription()));
+        }
+      }
+      const size_t index = decisions.size();
+      decisions.emplace_back(n, d, u, c, a);
+      active_counts.resize(active_counts.size() + agents, 0u);
+      execution_timestamps.resize(execution_timestamps.size() + agents);
+      last_scores.resize(last_scores.size() + agents, 0.f);
+      for (auto event : e) {
+        const size_t event_index = indexOf(event);
+        event_decisions[event_index].push_back(index);
+        for (size_t agent = 0; agent < agents; ++agent) {
+          if (active_events[event_index * agents + agent]) {
+            ++active_counts[index * agents + agent];
+          }
+        }
+      }
+      order.insert(std::upper_bound(order.begin(), order.end(), index,
+            [this](size_t x, size_t y) {
+              const Decision& lhs = decisions[x];
+              const Decision& rhs = decisions[y];
+              if (lhs.getUtility() != rhs.getUtility()) {
+                return lhs.getUtility() > rhs.getUtility();
+              }
+              return lhs.getUpperBound() > rhs.getUpperBound();
+            }),
+          index);
+    }
+
+    /** Load the Decisions associated with an Event for one agent. */
+    void raiseEvent(size_t agent, Event e) {
+      const size_t event_index = indexOf(e);
+      uint8_t& raised = active_events[event_index * agents + agent];
+      if (!raised) {
+        raised = 1;
+        for (size_t decision : event_decisions[event_index]) {
+          ++active_counts[decision * agents + agent];
+        }
+      }
+    }
+
+    /** Unload the Decisions associated with an Event for one agent. */
+    void clearEvent(size_t agent, Event e) {
+      auto it = event_indices.find(e);
+      if (it == event_indices.end()) {
+        return;
+      }
+      uint8_t& raised = active_events[it->second * agents + agent];
+      if (raised) {
+        raised = 0;
+        for (size_t decision : event_decisions[it->second]) {
+          --active_counts[decision * agents + agent];
+        }
+      }
+    }
+
+    /** Unload all Decisions of one agent. */
+    void clearActive(size_t agent) {
+      for (size_t event_index = 0; event_index < event_decisions.size(); ++event_index) {
+        active_events[event_index * agents + agent] = 0;
+      }
+      for (size_t decision = 0; decision < decisions.size(); ++decision) {
+        active_counts[decision * agents + agent] = 0;
+      }
+    }
+
+    /** Clear all known behaviors of all agents. */
+    void clear() {
+      decisions.clear();
+      order.clear();
+      event_indices.clear();
+      event_decisions.clear();
+      active_events.clear();
+      active_counts.clear();
+      execution_timestamps.clear();
+      last_scores.clear();
+      highest_scores.assign(agents, 0.f);
+      best_decisions.assign(agents, NO_DECISION);
+    }
+
+    /** Select the Decision with the highest score for every agent.
+     *
+     * Returns for each agent the index of its best Decision, which can be
+     * looked up with getDecision(size_t), or NO_DECISION when the agent has
+     * nothing loaded or when all its scores are zero.
+     */
+    const std::vector<size_t>& getBestDecisions() {
+      std::fill(highest_scores.begin(), highest_scores.end(), 0.f);
+      std::fill(best_decisions.begin(), best_decisions.end(), NO_DECISION);
+      std::fill(finished.begin(), finished.end(), uint8_t(0));
+      size_t remaining = agents;
+
+      for (size_t i = 0; i < order.size() && remaining > 0; ++i) {
+        const size_t decision = order[i];
+        const Decision& rule = decisions[decision];
+        const float utility = static_cast<float>(rule.getUtility());
+        if (!bool(utility)) {
+          break;
+        }
+        const size_t base = decision * agents;
+        size_t count = 0;
+        for (size_t agent = 0; agent < agents; ++agent) {
+          // Same pruning as DecisionEngine::getBestDecision, but per agent.
+          if (finished[agent] || !active_counts[base + agent]) {
+            continue;
+          }
+          if (utility < highest_scores[agent]) {
+            finished[agent] = 1;
+            --remaining;
+            continue;
+          }
+          if (rule.getUpperBound() <= highest_scores[agent]) {
+            BEHAVIOR_ENGINE_PROFILE_SKIP(rule.getProfile());
+            continue;
+          }
+          candidates[count++] = agent;
+        }
+        computeScores(rule, count);
+        for (size_t j = 0; j < count; ++j) {
+          const size_t agent = candidates[j];
+          const float score = totals[j];
+          last_scores[base + agent] = score;
+          if (score > highest_scores[agent]) {
+            highest_scores[agent] = score;
+            best_decisions[agent] = decision;
+            if (score >= utility) {
+              finished[agent] = 1;
+              --remaining;
+            }
+          }
+        }
+      }
+      return best_decisions;
+    }
+
+    /** Select and run the best Decision of every agent.
+     *
+     * Agents without an activated Decision are skipped.
+     */
+    void executeBestDecisions() {
+      getBestDecisions();
+      const Clock::time_point now = Clock::now();
+      for (size_t agent = 0; agent < agents; ++agent) {
+        const size_t decision = best_decisions[agent];
+        if (decision == NO_DECISION) {
+          continue;
+        }
+        current_agent = agent;
+        execution_timestamps[decision * agents + agent] = now;
+        decisions[decision].getAction()(decisions[decision]);
+      }
+    }
+
+    /** The agent whose Considerations or Action are being evaluated. */
+    size_t getAgent() const { return current_agent; }
+
+    size_t getDecisionCount() const { return decisions.size(); }
+    Decision& getDecision(size_t decision) { return decisions[decision]; }
+    const Decision& getDecision(size_t decision) const { return decisions[decision]; }
+
+    /** Score of a Decision the last time it was computed for an agent. */
+    float getLastScore(size_t agent, size_t decision) const {
+      return last_scores[decision * agents + agent];
+    }
+
+    /** Highest score of an agent in the last getBestDecisions(). */
+    float getBestScore(size_t agent) const {
+      return highest_scores[agent];
+    }
+
+    bool isActive(size_t agent, size_t decision) const {
+      return active_counts[decision * agents + agent] != 0;
+    }
+
+    Clock::time_point getExecutionTimestamp(size_t agent, size_t decision) const {
+      return execution_timestamps[decision * agents + agent];
+    }
+    Clock::duration getTimeSinceExecution(size_t agent, size_t decision) const {
+      return Clock::now() - getExecutionTimestamp(agent, decision);
+    }
+    bool isNeverExecuted(size_t agent, size_t decision) const {
+      return getExecutionTimestamp(agent, decision).time_since_epoch().count() == 0;
+    }
+
+  protected:
+    /** Shared rules, in the order in which they were added. */
+    std::vector<Decision> decisions;
+    /** Indices into decisions, sorted on UtilityScore. */
+    std::vector<size_t> order;
+    std::map<Event, size_t> event_indices;
+    /** For each event index, the Decisions it loads. */
+    std::vector<std::vector<size_t>> event_decisions;
+
+    // Per-agent state, laid out as [event or decision][agent].
+    size_t agents = 0;
+    std::vector<uint8_t> active_events;
+    std::vector<unsigned int> active_counts;
+    std::vector<Clock::time_point> execution_timestamps;
+    std::vector<float> last_scores;
+
+    // Per-agent scratch space of getBestDecisions().
+    std::vector<float> highest_scores;
+    std::vector<size_t> best_decisions;
+    std::vector<uint8_t> finished;
+    size_t current_agent = 0;
+
+    // Scratch space of computeScores(), indexed by candidate.
+    std::vector<size_t> candidates;
+    std::vector<size_t> live;
+    std::vector<float> totals;
+    std::vector<float> inputs;
+    std::vector<float> outputs;
+
+    /** Decision::computeScore for the first count candidates, into totals.
+     *
+     * Candidates whose total drops below the cut-off of
+     * Decision::computeScore leave the batch, so they keep exactly the
+     * score that Decision::computeScore would have returned for them.  The
+     * profile counts every candidate as an evaluation, and the time of a
+     * batch is shared by its candidates.
+     */
+    void computeScores(const Decision& rule, size_t count) {
+      if (rule.hasScorer()) {
+        for (size_t j = 0; j < count; ++j) {
+          current_agent = candidates[j];
+          totals[j] = rule.computeScore();
+        }
+        return;
+      }
+#if BEHAVIOR_ENGINE_PROFILE
+      ProfileCounters& profile = rule.getProfile();
+      const Clock::time_point start = Clock::now();
+      profile.evaluations += count;
+#endif
+      const ConsiderationList& rule_considerations = rule.getConsiderations();
+      const float modification_factor = rule.getModificationFactor();
+      const float utility = static_cast<float>(rule.getUtility());
+      for (size_t j = 0; j < count; ++j) {
+        totals[j] = utility;
+        live[j] = j;
+      }
+      for (size_t i = 0; i < rule_considerations.size() && count > 0; ++i) {
+        const Consideration& consideration = rule_considerations[i];
+#if BEHAVIOR_ENGINE_PROFILE
+        const Clock::time_point batch_start = Clock::now();
+#endif
+        for (size_t k = 0; k < count; ++k) {
+          current_agent = candidates[live[k]];
+          inputs[k] = consideration.computeInput();
+        }
+        Spline::evaluate(consideration.getSpline(), inputs.data(), outputs.data(), count);
+        size_t kept = 0;
+        for (size_t k = 0; k < count; ++k) {
+          float& total = totals[live[k]];
+          total *= Decision::weigh(clip(outputs[k]), modification_factor);
+          if (!(total < 1e-6f)) {
+            live[kept++] = live[k];
+          }
+        }
+#if BEHAVIOR_ENGINE_PROFILE
+        ProfileCounters& counters = consideration.getProfile();
+        counters.evaluations += count;
+        counters.time += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - batch_start);
+        if (i + 1 < rule_considerations.size()) {
+          counters.early_exits += count - kept;
+          profile.early_exits += count - kept;
+        }
+#endif
+        count = kept;
+      }
+#if BEHAVIOR_ENGINE_PROFILE
+      profile.time += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+#endif
+    }
+
+    size_t indexOf(Event e) {
+      auto it = event_indices.find(e);
+      if (it != event_indices.end()) {
+        return it->second;
+      }
+      const size_t event_index = event_decisions.size();
+      event_indices.emplace(e, event_index);
+      event_decisions.emplace_back();
+      active_events.resize(active_events.size() + agents, 0);
+      return event_index;
+    }
+
+    /** Change the agent stride of an array laid out as [row][agent]. */
+    template<class T>
+    void relayout(std::vector<T>& values, size_t rows, size_t n, const T& fill) {
+      std::vector<T> resized(rows * n, fill);
+      const size_t kept = std::min(agents, n);
+      for (size_t row = 0; row < rows; ++row) {
+        std::copy(values.begin() + static_cast<std::ptrdiff_t>(row * agents),
+            values.begin() + static_cast<std::ptrdiff_t>(row * agents + kept),
+            resized.begin() + static_cast<std::ptrdiff_t>(row * n));
+      }
+      values.swap(resized);
+    }
+};
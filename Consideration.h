@@ -1,8 +1,11 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include <string>
+#include "Profile.h"
 #include "Spline.h"
+#include "Text.h"
 
 using UtilityFunction = std::function<float()>;
 
@@ -32,38 +35,92 @@ class Consideration {
         Spline::SplineFunction spline,
         float min=1.f,
         float max=1.f)
-      : description_(description),
-      utilityFunction_(utilityFunction),
+      : utilityFunction_(utilityFunction),
       spline_(spline),
       min_(min),
-      max_(max)
+      max_(max),
+      max_score_(clip(Spline::maximum(spline_))),
+      description_(description)
     {}
 
     Consideration(const std::string& description,
         UtilityFunction utilityFunction,
         Spline::SplineFunction spline,
         range input_range)
-      : description_(description),
-      utilityFunction_(utilityFunction),
+      : utilityFunction_(utilityFunction),
       spline_(spline),
       min_(std::get<0>(input_range)),
-      max_(std::get<1>(input_range))
+      max_(std::get<1>(input_range)),
+      max_score_(clip(Spline::maximum(spline_))),
+      description_(description)
     {}
 
     Consideration() = default;
     Consideration(const Consideration& other) = default;
+    Consideration(Consideration&& other) = default;
     Consideration& operator=(const Consideration& other) = default;
+    Consideration& operator=(Consideration&& other) = default;
 
     /** Computes the utility score of this Consideration.  */
     inline float computeScore() const
     {
-      return clip(spline_(scale(utilityFunction_(), min_, max_)));
+      BEHAVIOR_ENGINE_PROFILE_SCOPE(profile_);
+      return clip(spline_(computeInput()));
     }
 
+    /** The input of the spline: the utilityFunction, scaled to its range. */
+    inline float computeInput() const
+    {
+      return scale(utilityFunction_(), min_, max_);
+    }
+
+    /** Replace the spline with a lookup table, see Spline::Baked.
+     *
+     * Returns the largest difference with the original spline that was
+     * found.  Splines that already are a table are kept.
+     */
+    float bake(size_t resolution = 256) {
+      if (spline_.target<Spline::Baked>() || spline_.target<Spline::Table>()) {
+        return 0.f;
+      }
+      Spline::Baked baked(spline_, resolution);
+      spline_ = baked;
+      spline_owner_ = nullptr;
+      max_score_ = clip(baked.getMaximum());
+      return baked.getMaxError();
+    }
+
+    /** Upper bound of computeScore(), see Spline::maximum. */
+    float getMaxScore() const { return max_score_; }
+
+    const std::string& getDescription() const { return description_.str(); }
+    void setDescription(const Text& description) { description_ = description; }
+    const Spline::SplineFunction& getSpline() const { return spline_; }
+    const UtilityFunction& getUtilityFunction() const { return utilityFunction_; }
+    void setUtilityFunction(const UtilityFunction& function) { utilityFunction_ = function; }
+
+    /** Replace the spline.
+     *
+     * owner keeps alive what spline refers to, if anything, for example the
+     * Arena that holds a Curve that spline refers to with std::cref.
+     */
+    void setSpline(const Spline::SplineFunction& spline, std::shared_ptr<const void> owner = nullptr) {
+      spline_ = spline;
+      spline_owner_ = std::move(owner);
+      max_score_ = clip(Spline::maximum(spline_));
+    }
+
+    /** Counters of computeScore(), see BEHAVIOR_ENGINE_PROFILE. */
+    ProfileCounters& getProfile() const { return profile_; }
+
   private:
-    std::string description_;
+    // What computeScore reads comes first, so that it shares cache lines.
     UtilityFunction utilityFunction_;
     Spline::SplineFunction spline_;
     float min_;
     float max_;
+    float max_score_ = 1.f;
+    Text description_;
+    std::shared_ptr<const void> spline_owner_;
+    mutable ProfileCounters profile_;
 };
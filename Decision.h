@@ -1,13 +1,40 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <string>
+#include <utility>
 #include <vector>
+#include "Arena.h"
 #include "Consideration.h"
+#include "Text.h"
 
 class Decision;
 using Action = std::function<void(Decision&)>;
+/** Computes the score of the Decision it is passed, like
+ *  Decision::computeScore(threshold), see Decision::setScorer. */
+using Scorer = std::function<float(const Decision&, float threshold)>;
+
+namespace detail {
+  template<size_t I, size_t N> struct StaticScore;
+}
+/** The Considerations of a Decision; in an Arena, see RuleSetBuilder. */
+using ConsiderationList = std::vector<Consideration, ArenaAllocator<Consideration>>;
+
+/** What adaptive ordering learns about a Consideration of a Decision. */
+struct ConsiderationStatistics {
+  /** Number of times computeScore was called. */
+  unsigned long evaluations = 0;
+  /** Number of times the Decision was abandoned right after it. */
+  unsigned long rejections = 0;
+  /** Number of evaluations that were timed; one in every eight scorings. */
+  unsigned long timed_evaluations = 0;
+  /** Total time spent in the timed evaluations. */
+  std::chrono::steady_clock::duration cost = std::chrono::steady_clock::duration::zero();
+};
 
 /**/
 enum class UtilityScore : int {
@@ -37,16 +64,34 @@ class Decision {
         UtilityScore utility,
         std::vector<Consideration> considerations,
         const Action& action)
-      : name_(name),
-      description_(description),
-      utility_(utility),
-      considerations_(considerations),
-      action_(action)
+      : Decision(Text(name), Text(description), utility,
+          ConsiderationList(std::make_move_iterator(considerations.begin()),
+            std::make_move_iterator(considerations.end())),
+          action)
     {}
 
+    /** Keeps the allocator of considerations, which is also used for the
+     *  upper bounds. */
+    Decision(Text name,
+        Text description,
+        UtilityScore utility,
+        ConsiderationList considerations,
+        Action action)
+      : utility_(utility),
+      considerations_(std::move(considerations)),
+      upper_bounds_(considerations_.get_allocator()),
+      name_(std::move(name)),
+      description_(std::move(description)),
+      action_(std::move(action))
+    {
+      computeUpperBounds();
+    }
+
     Decision() = default;
     Decision(const Decision& other) = default;
+    Decision(Decision&& other) = default;
     Decision& operator=(const Decision& other) = default;
+    Decision& operator=(Decision&& other) = default;
 
     /** Calculate the 'usefulness' of a Decision.
      *
@@ -64,20 +109,196 @@ class Decision {
      * The weighing factor adjusts for this.
      */
     float computeScore() const {
-      const float modification_factor = 1.f - (1.f / float(considerations_.size()));
+      BEHAVIOR_ENGINE_PROFILE_SCOPE(profile_);
+      if (scorer_) {
+        // No score is at most a negative threshold.
+        return scorer_(*this, -1.f);
+      }
+      const float modification_factor = getModificationFactor();
       float total_score = static_cast<float>(utility_);
-      float score = 0.f;
-      for (auto& consideration : considerations_) {
-        score = consideration.computeScore();
-        total_score *= score + ((1.f - score) * modification_factor * score);
-        if (total_score < 1e-6f) break;
+      for (size_t i = 0; i < considerations_.size(); ++i) {
+        total_score *= weigh(considerations_[i].computeScore(), modification_factor);
+        if (total_score < 1e-6f) {
+          profileExit(i + 1);
+          break;
+        }
+      }
+      return total_score;
+    }
+
+    /** Calculate the score, but stop once it cannot exceed threshold.
+     *
+     * Before each Consideration, the score so far is multiplied with the
+     * upper bound of the remaining Considerations.  Once that is at most
+     * threshold, this Decision cannot beat it, and that bound (a value of at
+     * most threshold) is returned without computing the rest.  Otherwise
+     * the result equals computeScore().
+     */
+    float computeScore(float threshold) const {
+      BEHAVIOR_ENGINE_PROFILE_SCOPE(profile_);
+      if (scorer_) {
+        return scorer_(*this, threshold);
+      }
+      if (reorder_period_ > 0) {
+        return computeScoreAdaptively(threshold);
+      }
+      const float modification_factor = getModificationFactor();
+      float total_score = static_cast<float>(utility_);
+      for (size_t i = 0; i < considerations_.size(); ++i) {
+        const float bound = total_score * upper_bounds_[i];
+        if (bound <= threshold) {
+          profileExit(i);
+          return bound;
+        }
+        total_score *= weigh(considerations_[i].computeScore(), modification_factor);
+        if (total_score < 1e-6f) {
+          profileExit(i + 1);
+          break;
+        }
       }
       return total_score;
     }
 
-    const std::string& getName() const { return name_; }
-    const std::string& getDescription() const { return description_; }
+    /** The highest score this Decision can reach.
+     *
+     * Computed from Consideration::getMaxScore of all Considerations, with a
+     * little slack for rounding, so computeScore() never exceeds it.
+     */
+    float getUpperBound() const {
+      return static_cast<float>(utility_) * (upper_bounds_.empty() ? 1.f : upper_bounds_.front());
+    }
+
+    /** Let the order of the Considerations adapt to how they perform.
+     *
+     * While enabled, computeScore(float) records for every Consideration
+     * how often it is evaluated, how long that takes (sampled in one of
+     * every eight scorings), and how often the
+     * Decision is abandoned right after it, because its score dropped below
+     * the cut-off or the bound of the rest fell below the threshold.  Every
+     * period scorings, adapt() sorts the order in which the Considerations
+     * are evaluated, so that cheap ones that often reject come first, like
+     * a query optimizer orders predicates: on cost divided by rejection
+     * rate.  getConsiderations() keeps its order.
+     *
+     * This only changes how early a hopeless Decision is abandoned.  The
+     * factors of the Considerations are multiplied in their own order, so
+     * whenever the result can exceed the threshold, it is exactly what
+     * computeScore() returns, and the same Decision wins ties.
+     *
+     * A period of 0 disables it.  Decisions with a scorer, see
+     * StaticConsiderations, are not reordered, but do stop early.
+     */
+    void setAdaptiveOrdering(unsigned int period) {
+      reorder_period_ = period;
+      scorings_ = 0;
+      const size_t count = period > 0 ? considerations_.size() : 0;
+      statistics_.assign(count, ConsiderationStatistics());
+      factors_.assign(count, 0.f);
+      order_.resize(count);
+      for (size_t i = 0; i < count; ++i) {
+        order_[i] = i;
+      }
+      computeUpperBounds();
+    }
+
+    /** Reorder the Considerations if adaptive ordering is due.
+     *
+     * Returns whether the order was changed.  Statistics are halved after
+     * reordering, so the order keeps following changes in behavior.
+     */
+    bool adapt() {
+      if (reorder_period_ == 0 || scorings_ < reorder_period_ || scorer_) {
+        return false;
+      }
+      scorings_ = 0;
+      // Insertion sort: stable, in place, and there are only a few.
+      bool changed = false;
+      for (size_t i = 1; i < order_.size(); ++i) {
+        for (size_t j = i; j > 0 && rank(statistics_[order_[j]]) < rank(statistics_[order_[j - 1]]); --j) {
+          std::swap(order_[j], order_[j - 1]);
+          changed = true;
+        }
+      }
+      for (auto& statistics : statistics_) {
+        statistics.evaluations /= 2;
+        statistics.rejections /= 2;
+        statistics.timed_evaluations /= 2;
+        statistics.cost /= 2;
+      }
+      if (changed) {
+        computeUpperBounds();
+      }
+      return changed;
+    }
+
+    /** Counters of computeScore, see BEHAVIOR_ENGINE_PROFILE.
+     *
+     * The counters of the Considerations are kept by the Considerations.
+     */
+    ProfileCounters& getProfile() const { return profile_; }
+
+    /** Statistics of adaptive ordering, in the order of getConsiderations(). */
+    const std::vector<ConsiderationStatistics>& getConsiderationStatistics() const {
+      return statistics_;
+    }
+
+    /** Compute the score with a function instead of the Considerations.
+     *
+     * The scorer must compute the same value as computeScore(threshold)
+     * would, in the order of getConsiderations(), and count the profile of
+     * the Considerations, see StaticConsiderations.  Changing the
+     * Considerations afterwards (for example by baking them) removes the
+     * scorer.
+     */
+    void setScorer(const Scorer& scorer) {
+      scorer_ = scorer;
+      // Undo adaptive ordering, so the upper bounds follow that order.
+      for (size_t i = 0; i < order_.size(); ++i) {
+        order_[i] = i;
+      }
+      computeUpperBounds();
+    }
+    bool hasScorer() const { return bool(scorer_); }
+    const Scorer& getScorer() const { return scorer_; }
+
+    /** Bake the splines of all Considerations, see Consideration::bake.
+     *
+     * Returns the largest error of any of them.
+     */
+    float bake(size_t resolution = 256) {
+      scorer_ = nullptr;
+      float max_error = 0.f;
+      for (auto& consideration : considerations_) {
+        max_error = std::max(max_error, consideration.bake(resolution));
+      }
+      computeUpperBounds();
+      return max_error;
+    }
+
+    /** Replace the UtilityFunction of a Consideration, and the scorer.
+     *
+     * index is in the order of getConsiderations().  Used by InputRecorder
+     * and InputReplay.
+     */
+    void setUtilityFunction(size_t index, const UtilityFunction& function) {
+      scorer_ = nullptr;
+      considerations_[index].setUtilityFunction(function);
+    }
+
+    /** The weighing factor for the number of Considerations. */
+    float getModificationFactor() const {
+      return 1.f - (1.f / float(considerations_.size()));
+    }
+
+    /** The factor by which a Consideration score changes the total score. */
+    static float weigh(float score, float modification_factor) {
+      return score + ((1.f - score) * modification_factor * score);
+    }
+
+    const std::string& getName() const { return name_.str(); }
+    const std::string& getDescription() const { return description_.str(); }
     UtilityScore getUtility() const { return utility_; }
+    const ConsiderationList& getConsiderations() const { return considerations_; }
     const Action& getAction() const { return action_; }
     const Clock::time_point getExecutionTimestamp() const { return execution_timestamp_; }
     const Clock::duration getTimeSinceExecution() const {
@@ -97,10 +318,136 @@ class Decision {
     }
 
   private:
-    std::string name_;
-    std::string description_;
+    template<size_t I, size_t N> friend struct detail::StaticScore;
+
+    // What computeScore reads comes first, so that it shares cache lines.
     UtilityScore utility_;
-    std::vector<Consideration> considerations_;
+    ConsiderationList considerations_;
+    /** upper_bounds_[i] bounds the factor of the Considerations from the
+     *  i-th evaluated one on, see evaluated(). */
+    std::vector<float, ArenaAllocator<float>> upper_bounds_;
+    Scorer scorer_;
+    unsigned int reorder_period_ = 0;
+    mutable unsigned int scorings_ = 0;
+    /** Indices into considerations_, in the order of evaluation, while
+     *  adaptive ordering is enabled. */
+    std::vector<size_t> order_;
+    /** Scratch space of computeScoreAdaptively: the factor of each
+     *  Consideration, or -1 if it was not evaluated. */
+    mutable std::vector<float> factors_;
+    mutable std::vector<ConsiderationStatistics> statistics_;
+    Text name_;
+    Text description_;
     Action action_;
+    mutable ProfileCounters profile_;
     std::chrono::steady_clock::time_point execution_timestamp_;
+
+    /** Index into considerations_ of the i-th evaluated Consideration. */
+    size_t evaluated(size_t i) const {
+      return order_.empty() ? i : order_[i];
+    }
+
+    /** Count an early exit after computing `computed` Considerations. */
+    void profileExit(size_t computed) const {
+#if BEHAVIOR_ENGINE_PROFILE
+      if (computed < considerations_.size()) {
+        ++profile_.early_exits;
+        if (computed > 0) {
+          ++considerations_[evaluated(computed - 1)].getProfile().early_exits;
+        }
+      }
+#else
+      (void) computed;
+#endif
+    }
+
+    /** Cost per rejection; lower runs earlier.
+     *
+     * A Consideration that was never evaluated goes behind the others,
+     * because nothing is known about it.
+     */
+    static double rank(const ConsiderationStatistics& statistics) {
+      if (statistics.evaluations == 0 || statistics.timed_evaluations == 0) {
+        return std::numeric_limits<double>::infinity();
+      }
+      const double cost = static_cast<double>(statistics.cost.count())
+        / static_cast<double>(statistics.timed_evaluations);
+      const double rejection_rate = static_cast<double>(statistics.rejections)
+        / static_cast<double>(statistics.evaluations);
+      return cost / std::max(rejection_rate, 1e-3);
+    }
+
+    /** computeScore(float) in the adapted order, while recording
+     *  ConsiderationStatistics. */
+    float computeScoreAdaptively(float threshold) const {
+      // Reading the clock costs about as much as a cheap Consideration, so
+      // only one in every eight scorings is timed.
+      const bool timed = (scorings_++ & 7) == 0;
+      const float modification_factor = getModificationFactor();
+      std::fill(factors_.begin(), factors_.end(), -1.f);
+      float total_score = static_cast<float>(utility_);
+      for (size_t i = 0; i < order_.size(); ++i) {
+        const size_t c = order_[i];
+        const float bound = total_score * upper_bounds_[i];
+        if (bound <= threshold) {
+          if (i > 0) ++statistics_[order_[i - 1]].rejections;
+          profileExit(i);
+          return bound;
+        }
+        float score;
+        if (timed) {
+          const Clock::time_point start = Clock::now();
+          score = considerations_[c].computeScore();
+          statistics_[c].cost += Clock::now() - start;
+          ++statistics_[c].timed_evaluations;
+        } else {
+          score = considerations_[c].computeScore();
+        }
+        ++statistics_[c].evaluations;
+        factors_[c] = weigh(score, modification_factor);
+        total_score *= factors_[c];
+        if (total_score < 1e-6f) {
+          ++statistics_[c].rejections;
+          profileExit(i + 1);
+          if (threshold >= 2e-6f) {
+            // computeScore() is below the cut-off too (up to rounding), so
+            // it cannot exceed threshold.
+            return total_score;
+          }
+          break;
+        }
+      }
+      return productOfFactors(modification_factor);
+    }
+
+    /** computeScore(), from the factors that computeScoreAdaptively found.
+     *
+     * Multiplies in the order of considerations_, so that it rounds the
+     * same, and evaluates the Considerations that it still needs.
+     */
+    float productOfFactors(float modification_factor) const {
+      float total_score = static_cast<float>(utility_);
+      for (size_t c = 0; c < considerations_.size(); ++c) {
+        total_score *= factors_[c] >= 0.f
+          ? factors_[c]
+          : weigh(considerations_[c].computeScore(), modification_factor);
+        if (total_score < 1e-6f) {
+          break;
+        }
+      }
+      return total_score;
+    }
+
+    void computeUpperBounds() {
+      const float modification_factor = getModificationFactor();
+      upper_bounds_.resize(considerations_.size() + 1);
+      // weigh() is increasing on [0, 1], so the bounds of the Considerations
+      // give a bound of the product.  The slack covers rounding differences
+      // between this product and the one in computeScore.
+      upper_bounds_.back() = 1.0001f;
+      for (size_t i = considerations_.size(); i-- > 0; ) {
+        upper_bounds_[i] = upper_bounds_[i + 1]
+          * weigh(considerations_[evaluated(i)].getMaxScore(), modification_factor);
+      }
+    }
 };
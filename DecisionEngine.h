@@ -1,20 +1,36 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <functional>
 #include <limits>
 #include <map>
 #include <memory>
+#include <random>
 #include <set>
 #include <string>
 #include <vector>
 
+#include "AsyncUtility.h"
 #include "Consideration.h"
 #include "Decision.h"
+#include "EventSet.h"
+#include "Exceptions.h"
+#include "FlightRecorder.h"
+#include "InputRecorder.h"
+#include "InputChannel.h"
+#include "Profile.h"
 #include "Spline.h"
+#include "StaticConsideration.h"
+#include "ThreadPool.h"
 
-#ifdef NDEBUG
+/** Set to 1 to print every step of getBestDecision to std::cout. */
+#ifndef BEHAVIOR_ENGINE_TRACE
+#define BEHAVIOR_ENGINE_TRACE 0
+#endif
+
+#if BEHAVIOR_ENGINE_TRACE
 #include <iostream>
 #endif
 
@@ -38,9 +54,17 @@ constexpr float DEFAULT_SCORE = -1.0;
  *    should be static.
  */
 #define consideration(DESCRIPTION, RANGE, TRANSFORM, FN) \
-  Consideration(DESCRIPTION, [&]() mutable FN, TRANSFORM, RANGE)
+  makeConsideration(DESCRIPTION, [&]() mutable FN, TRANSFORM, RANGE)
 #define actions [&](Decision& theDecision) mutable
 
+/** A Consideration that reads a shared Input instead of its own lambda.
+ *
+ * INPUT is an Input, for example the result of DecisionEngine::addInput or
+ * DecisionEngine::getInput("distance to ball").  See InputChannel.
+ */
+#define input_consideration(DESCRIPTION, RANGE, TRANSFORM, INPUT) \
+  makeConsideration(DESCRIPTION, INPUT, TRANSFORM, RANGE)
+
 // TODO: Fill this with your application-specific list of events.
 enum class Event : unsigned int;
 
@@ -78,15 +102,341 @@ class DecisionException : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+/** Index of a Decision in a RuleSet. */
+using DecisionHandle = size_t;
+
+/** A DecisionHandle that refers to no Decision. */
+constexpr DecisionHandle NO_DECISION = std::numeric_limits<DecisionHandle>::max();
+
+/** The Decisions known to a DecisionEngine, filed under their Events.
+ *
+ * Every Decision is stored once, when it is added, and is referred to by
+ * its DecisionHandle.  A RuleSet can be built on any thread and handed to
+ * a running engine with DecisionEngine::publish, see RuleSetExchange.
+ *
+ * Next to the Decisions, a RuleSet keeps a Summary of each of them in a
+ * dense array.  getBestDecision reads the Summaries of all active rules,
+ * and only the Decisions it actually scores.
+ */
+class RuleSet {
+  public:
+    /** What getBestDecision reads of every active rule. */
+    struct Summary {
+      /** Decision::getUtility, as a score. */
+      float utility;
+      /** Decision::getUpperBound. */
+      float upper_bound;
+      Decision* decision;
+    };
+
+    /** Add a new Decision.  Returns its handle. */
+    DecisionHandle addDecision(const name& n,
+        const description& d,
+        UtilityScore u,
+        events e,
+        considerations c,
+        const Action& a)
+    {
+      const DecisionHandle handle = store(std::make_shared<Decision>(n, d, u, c, a), e);
+      decisions[handle]->setAdaptiveOrdering(adaptive_ordering_period);
+      return handle;
+    }
+
+    /** Add a new Decision whose Considerations are statically dispatched.
+     *
+     * Use static_considerations(...) instead of `considerations {...}` to
+     * let the compiler inline all Considerations into the scoring of this
+     * Decision.
+     */
+    template<class... Cs>
+    DecisionHandle addDecision(const name& n,
+        const description& d,
+        UtilityScore u,
+        events e,
+        const StaticConsiderations<Cs...>& c,
+        const Action& a)
+    {
+      const DecisionHandle handle = store(std::make_shared<Decision>(n, d, u, c, a), e);
+      decisions[handle]->setScorer([c](const Decision& decision, float threshold) {
+          return c.computeScore(decision, threshold);
+        });
+      return handle;
+    }
+
+    /** Add a Decision that was made elsewhere, see RuleSetBuilder. */
+    DecisionHandle addDecision(std::shared_ptr<Decision> decision, const events& e) {
+      const DecisionHandle handle = store(std::move(decision), e);
+      decisions[handle]->setAdaptiveOrdering(adaptive_ordering_period);
+      return handle;
+    }
+
+    /** Make room for count Decisions. */
+    void reserve(size_t count) {
+      decisions.reserve(count);
+      summaries.reserve(count);
+    }
+
+    /** Replace the splines of all Decisions with lookup tables.
+     *
+     * See Spline::Baked.  Returns the largest error of any baked spline.
+     */
+    float bakeSplines(size_t resolution = 256) {
+      float max_error = 0.f;
+      for (auto& decision : decisions) {
+        max_error = std::max(max_error, decision->bake(resolution));
+      }
+      // Baking changes the upper bounds, on which the rules are sorted.
+      for (DecisionHandle handle = 0; handle < decisions.size(); ++handle) {
+        refresh(handle);
+      }
+      for (auto& rule : rules) {
+        std::stable_sort(rule.second.begin(), rule.second.end(),
+            [this](DecisionHandle x, DecisionHandle y) { return precedes(x, y); });
+      }
+      return max_error;
+    }
+
+    /** See DecisionEngine::setAdaptiveOrdering. */
+    void setAdaptiveOrdering(unsigned int period) {
+      adaptive_ordering_period = period;
+      for (auto& decision : decisions) {
+        decision->setAdaptiveOrdering(period);
+      }
+    }
+
+    unsigned int getAdaptiveOrdering() const { return adaptive_ordering_period; }
+
+    /** Update the Summary of a Decision after its upper bound changed, for
+     *  example by Decision::adapt or Decision::bake. */
+    void refresh(DecisionHandle handle) {
+      summaries[handle].upper_bound = decisions[handle]->getUpperBound();
+    }
+
+    void clear() {
+      decisions.clear();
+      summaries.clear();
+      rules.clear();
+      rule_count = 0;
+    }
+
+    void swap(RuleSet& other) {
+      decisions.swap(other.decisions);
+      summaries.swap(other.summaries);
+      rules.swap(other.rules);
+      std::swap(rule_count, other.rule_count);
+      std::swap(adaptive_ordering_period, other.adaptive_ordering_period);
+    }
+
+    const std::shared_ptr<Decision>& getDecision(DecisionHandle handle) const {
+      return decisions[handle];
+    }
+
+    const Summary& getSummary(DecisionHandle handle) const {
+      return summaries[handle];
+    }
+
+    /** The Decisions of an Event, sorted, or nullptr if it has none. */
+    const std::vector<DecisionHandle>* getRules(Event e) const {
+      auto rule = rules.find(e);
+      return rule == rules.end() ? nullptr : &rule->second;
+    }
+
+    size_t getDecisionCount() const { return decisions.size(); }
+    size_t getEventCount() const { return rules.size(); }
+    /** Number of Decisions of all Events together. */
+    size_t getRuleCount() const { return rule_count; }
+
+    /** Whether Decision x goes before Decision y in the rules.
+     *
+     * Decisions are sorted on their UtilityScore, and Decisions with the
+     * same UtilityScore on their upper bound, see Decision::getUpperBound.
+     */
+    bool precedes(DecisionHandle x, DecisionHandle y) const {
+      const Summary& a = summaries[x];
+      const Summary& b = summaries[y];
+      if (a.utility != b.utility) {
+        return a.utility > b.utility;
+      }
+      return a.upper_bound > b.upper_bound;
+    }
+
+  private:
+    /** Every Decision that was added, indexed by DecisionHandle. */
+    std::vector<std::shared_ptr<Decision>> decisions;
+    /** The Summary of each of decisions. */
+    std::vector<Summary> summaries;
+    /** For each Event, its Decisions sorted with precedes. */
+    std::map<Event, std::vector<DecisionHandle>> rules;
+    size_t rule_count = 0;
+    unsigned int adaptive_ordering_period = 0;
+
+    friend class RuleSetExchange;
+    /** The next retired RuleSet, see RuleSetExchange::retire. */
+    RuleSet* next_retired = nullptr;
+
+    DecisionHandle store(std::shared_ptr<Decision> decision, const events& e) {
+      const DecisionHandle handle = decisions.size();
+      summaries.push_back({static_cast<float>(decision->getUtility()),
+          decision->getUpperBound(), decision.get()});
+      decisions.push_back(std::move(decision));
+      for (auto event : e) {
+        auto rule = rules.find(event);
+        if (rule == rules.end()) {
+          rule = rules.emplace(event, std::vector<DecisionHandle>()).first;
+        }
+        std::vector<DecisionHandle>& handles = rule->second;
+        handles.insert(std::upper_bound(handles.begin(), handles.end(), handle,
+              [this](DecisionHandle x, DecisionHandle y) { return precedes(x, y); }),
+            handle);
+      }
+      rule_count += e.size();
+      return handle;
+    }
+};
+
+/** Hands RuleSets from a builder thread to the thread that ticks.
+ *
+ * publish() and take() exchange a single pointer, so neither side ever
+ * waits for the other.  The tick thread does not free the RuleSet it
+ * replaces, but retires it; the next publish() frees all retired RuleSets
+ * on the builder thread.  Copies start out empty.
+ */
+class RuleSetExchange {
+  public:
+    RuleSetExchange() = default;
+    RuleSetExchange(const RuleSetExchange&) {}
+    RuleSetExchange& operator=(const RuleSetExchange&) { return *this; }
+
+    ~RuleSetExchange() {
+      delete pending_.load();
+      destroy(retired_.load());
+    }
+
+    /** Offer a RuleSet.  Replaces any RuleSet that was not taken yet. */
+    void publish(std::unique_ptr<RuleSet> rules) {
+      destroy(retired_.exchange(nullptr, std::memory_order_acquire));
+      delete pending_.exchange(rules.release(), std::memory_order_acq_rel);
+    }
+
+    /** The published RuleSet, or nullptr.  The caller owns it. */
+    RuleSet* take() {
+      if (pending_.load(std::memory_order_relaxed) == nullptr) {
+        return nullptr;
+      }
+      return pending_.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    /** Leave a RuleSet to be freed by the next publish().
+     *
+     * The retired RuleSets form a list, so that this never frees one, also
+     * when several were taken since the last publish().
+     */
+    void retire(RuleSet* rules) {
+      rules->next_retired = retired_.load(std::memory_order_relaxed);
+      while (!retired_.compare_exchange_weak(rules->next_retired, rules,
+            std::memory_order_release, std::memory_order_relaxed)) {
+      }
+    }
+
+  private:
+    std::atomic<RuleSet*> pending_{nullptr};
+    /** The last retired RuleSet, which links to the ones before it. */
+    std::atomic<RuleSet*> retired_{nullptr};
+
+    static void destroy(RuleSet* rules) {
+      while (rules != nullptr) {
+        RuleSet* next = rules->next_retired;
+        delete rules;
+        rules = next;
+      }
+    }
+};
+
+/** Why DecisionEngine::tryGetBestDecision did or did not select a Decision. */
+enum class SelectionReason {
+  /** A Decision was selected. */
+  Selected,
+  /** No Decisions are loaded for the raised Events. */
+  NoActiveRules,
+  /** Every loaded Decision scored 0. */
+  NoPositiveScore,
+  /** The deadline passed before any Decision scored above 0. */
+  OutOfTime,
+};
+
+inline const char* toString(SelectionReason reason) {
+  switch (reason) {
+    case SelectionReason::Selected: return "Selected";
+    case SelectionReason::NoActiveRules: return "Empty active rule set";
+    case SelectionReason::NoPositiveScore: return "No rule was activated";
+    case SelectionReason::OutOfTime: return "Out of time";
+  }
+  return "Unknown";
+}
+
+/** Result of DecisionEngine::tryGetBestDecision. */
+struct SelectionResult {
+  /** The selected Decision, or NO_DECISION. */
+  DecisionHandle handle = NO_DECISION;
+  /** Its score, or 0. */
+  float score = 0.f;
+  SelectionReason reason = SelectionReason::NoActiveRules;
+  /** Whether all Decisions that could win were considered in time. */
+  bool complete = true;
+
+  explicit operator bool() const { return reason == SelectionReason::Selected; }
+};
+
+/** How DecisionEngine::getBestDecision picks among the scored Decisions. */
+enum class SelectionMode {
+  /** The one with the highest score, the first of equals. */
+  Best,
+  /** A random one near the highest score, see DecisionEngine::setSelectionMode. */
+  WeightedRandom,
+};
+
+/** A Decision with its score, see DecisionEngine::tryGetBestDecisions. */
+struct RankedDecision {
+  DecisionHandle handle;
+  float score;
+};
+
+/** Result of DecisionEngine::getBestDecision with a deadline. */
+struct AnytimeSelection {
+  /** The best Decision found, or nullptr. */
+  std::shared_ptr<Decision> decision;
+  /** Its score, or 0. */
+  float score = 0.f;
+  /** Whether all Decisions that could win were considered in time. */
+  bool complete = false;
+};
+
 /** Lazily selects a Decision with the highest score from an activated subset.
  *
  * The DecisionEngine selects the optimal Decision, based on its
  * Decision::computeScore.  Each Decision is associated with an Event.  By
  * raising and clearing an Event, you load and unload the associated
  * Decisions into the set of active Decisions.
+ *
+ * The Decisions are kept in a RuleSet, and the active set refers to them by
+ * their DecisionHandle.  Loading and unloading Decisions thus keeps their
+ * state, such as the time they were last executed, and needs no
+ * allocations: raiseEvent and clearEvent move handles within storage that
+ * addDecision has reserved.
+ *
+ * Events below 64 are kept as a bitmask, and the sorted active set of
+ * every combination of them that was seen is cached under its mask.
+ * Returning to such a combination, like going back from penalized to
+ * playing, swaps the cached active set in instead of rebuilding it.
+ *
+ * To change the behavior while the engine keeps ticking, build a new
+ * RuleSet on another thread and publish it.  The next getBestDecision
+ * switches to it without waiting.
  */
 class DecisionEngine {
   public:
+    using Clock = Decision::Clock;
+
 #if !defined(BHUMAN) || !BHUMAN
     DecisionEngine() = default;
 #endif
@@ -103,10 +453,24 @@ class DecisionEngine {
         considerations c,
         const Action& a)
     {
-      for (auto event : e) {
-        rules[event].emplace_back(n, d, u, c, a);
-        updated_events.insert(event);
-      }
+      load(rule_set.addDecision(n, d, u, e, c, a), e);
+    }
+
+    /** Add a new Decision whose Considerations are statically dispatched.
+     *
+     * Use static_considerations(...) instead of `considerations {...}` to
+     * let the compiler inline all Considerations into the scoring of this
+     * Decision.
+     */
+    template<class... Cs>
+    void addDecision(const name& n,
+        const description& d,
+        UtilityScore u,
+        events e,
+        const StaticConsiderations<Cs...>& c,
+        const Action& a)
+    {
+      load(rule_set.addDecision(n, d, u, e, c, a), e);
     }
 
     /** Load behavior associated with a specific Event.
@@ -115,17 +479,16 @@ class DecisionEngine {
      * To unload these behaviors, use clearEvent(Event) to remove all
      * Decisions associated to a specific event, or clearActive() to empty the
      * list of active Decisions.
+     *
+     * Raising an Event that was known to addDecision does not allocate,
+     * unless the cache of setSnapshotLimit is enabled and this combination
+     * of Events was not seen before.
      */
     void raiseEvent(Event e) {
-      if (!updated_events.empty()) {
-        sort_decisions();
-      }
-      if (active_events.find(e) == active_events.end()) {
-        for (auto& decision : rules[e]) {
-          active_rules.emplace_back(e, std::make_shared<Decision>(decision));
-        }
-        active_events.insert(e);
-        sort_active_decisions();
+      const bool was_dense = active_events.isDense();
+      const EventMask from = active_events.mask();
+      if (active_events.insert(e) && !switchSnapshot(was_dense, from)) {
+        activate(e);
       }
 #if defined(BHUMAN) && BHUMAN
       initializeActivationGraph();
@@ -139,7 +502,8 @@ class DecisionEngine {
      */
     void clear() {
       clearActive();
-      rules.clear();
+      rule_set.clear();
+      snapshots.clear();
     }
 
     /** Clear all active behavior.
@@ -147,8 +511,12 @@ class DecisionEngine {
      * After this, use raiseEvent(Event) to load Decisions into the engine.
      */
     void clearActive() {
-      active_rules.clear();
+      const bool was_dense = active_events.isDense();
+      const EventMask from = active_events.mask();
       active_events.clear();
+      if (!switchSnapshot(was_dense, from)) {
+        active_rules.clear();
+      }
     }
 
     /** Clear Decisions associated with an event.
@@ -156,20 +524,207 @@ class DecisionEngine {
      * This might leave the engine empty.
      */
     void clearEvent(Event e) {
-      active_rules.erase(std::remove_if(active_rules.begin(), active_rules.end(),
-            [e](const Rule& entry) {
-            return std::get<0>(entry) == e;
-            }),
-          active_rules.end());
-      const auto& it = std::get<0>(active_events.insert(e));
-      active_events.erase(it);
+      const bool was_dense = active_events.isDense();
+      const EventMask from = active_events.mask();
+      if (active_events.erase(e) && !switchSnapshot(was_dense, from)) {
+        active_rules.erase(std::remove_if(active_rules.begin(), active_rules.end(),
+              [e](const Rule& entry) {
+              return std::get<0>(entry) == e;
+              }),
+            active_rules.end());
+      }
 #if defined(BHUMAN) && BHUMAN
       initializeActivationGraph();
 #endif
     }
 
+    /** Replace the splines of all Decisions with lookup tables.
+     *
+     * See Spline::Baked.  Returns the largest error of any baked spline.
+     */
+    float bakeSplines(size_t resolution = 256) {
+      const float max_error = rule_set.bakeSplines(resolution);
+      std::stable_sort(active_rules.begin(), active_rules.end(),
+          [this](const Rule& x, const Rule& y) {
+            return rule_set.precedes(std::get<1>(x), std::get<1>(y));
+          });
+      snapshots.clear();
+      return max_error;
+    }
+
+    /** Let all Decisions reorder their Considerations as they learn.
+     *
+     * See Decision::setAdaptiveOrdering.  Every period scorings of a
+     * Decision, getBestDecision reorders its Considerations.  A period of 0
+     * disables it.
+     */
+    void setAdaptiveOrdering(unsigned int period) {
+      rule_set.setAdaptiveOrdering(period);
+    }
+
+    /** Score the Decisions of each UtilityScore tier on a ThreadPool.
+     *
+     * getBestDecision then scores all promising Decisions of a tier at
+     * once, against the best score of the tiers above it, and picks the
+     * same Decision as it would have sequentially: the first one with the
+     * highest score.  Tiers that cannot beat that score are still skipped.
+     *
+     * Considerations are called from several threads at once, so they
+     * should only read shared state.  An InputChannel is computed by the
+     * first thread that reads it in a tick, while others that read it wait.
+     * Pass nullptr to score sequentially again.
+     */
+    void setThreadPool(std::shared_ptr<ThreadPool> pool) {
+      thread_pool = pool;
+      reserveScratch();
+    }
+
+    /** Choose how getBestDecision picks a Decision.
+     *
+     * In SelectionMode::WeightedRandom, it picks a random Decision among
+     * those that score above the highest score minus margin, with a chance
+     * proportional to its score.  This makes an agent less predictable
+     * among nearly equal options, but never lets it take a bad one.
+     *
+     * The scores come from the scan itself, which only skips what cannot
+     * get within margin of the best, so a wider margin scores more
+     * Decisions.  Picking is a binary search in a prefix sum of the scores,
+     * in storage that is reserved with the rules.  The scan is sequential,
+     * also with a ThreadPool.  A margin of 0 selects like Best, and
+     * tryGetBestDecisions always ranks.
+     */
+    void setSelectionMode(SelectionMode mode, float margin = 0.f) {
+      selection_mode = mode;
+      selection_margin = margin;
+      reserveScratch();
+    }
+
+    SelectionMode getSelectionMode() const { return selection_mode; }
+    float getSelectionMargin() const { return selection_margin; }
+
+    /** Seed the random numbers of SelectionMode::WeightedRandom. */
+    void seedSelection(std::mt19937::result_type seed) {
+      random_engine.seed(seed);
+    }
+
+    /** Record every tick into a FlightRecorder.
+     *
+     * Pass nullptr to stop recording.  The recorder should not be shared
+     * with another engine.
+     */
+    void setFlightRecorder(std::shared_ptr<FlightRecorder> recorder) {
+      flight_recorder = recorder;
+      recordNames();
+    }
+
+    /** Record the inputs of every tick into an InputRecorder.
+     *
+     * Pass nullptr to stop recording, which restores the UtilityFunctions.
+     */
+    void setInputRecorder(std::shared_ptr<InputRecorder> recorder) {
+      if (input_recorder) {
+        InputRecorder::detach(rule_set);
+      }
+      input_recorder = recorder;
+      if (input_recorder) {
+        input_recorder->attach(rule_set);
+      }
+    }
+
+    /** Register a named input that is computed at most once per tick.
+     *
+     * The returned Input can be read from any number of Considerations,
+     * either in their lambda or through input_consideration.  Registering a
+     * name again replaces its function.  See InputChannel.
+     */
+    Input addInput(const std::string& input_name, const UtilityFunction& function) {
+      return input_channels.add(input_name, function);
+    }
+
+    /** The Input registered under this name, or an empty Input. */
+    Input getInput(const std::string& input_name) const {
+      return input_channels.get(input_name);
+    }
+
     const std::set<Event> getActiveEvents(){
-        return active_events;
+        std::set<Event> raised;
+        active_events.forEach([&raised](Event e) { raised.insert(e); });
+        return raised;
+    }
+
+    /** Cache up to limit active sets.
+     *
+     * Every combination of raised Events below 64 that is left is cached,
+     * at the cost of one copy of its active set, so that going back to it
+     * costs a swap instead of a merge.  Caching a new combination
+     * allocates.  When the limit is reached the cache is emptied.  The
+     * limit is 0 by default, which disables the cache, so that raiseEvent
+     * and clearEvent never allocate.
+     */
+    void setSnapshotLimit(size_t limit) {
+      snapshot_limit = limit;
+      snapshots.clear();
+    }
+
+    /** The Decision behind a handle. */
+    std::shared_ptr<Decision> getDecision(DecisionHandle handle) {
+      return rule_set.getDecision(handle);
+    }
+
+    const RuleSet& getRuleSet() const { return rule_set; }
+
+    /** The rules of this engine, to change their Decisions in place.
+     *
+     * Not while this engine is ticking, for example on a TickScheduler, nor
+     * while another thread uses its Decisions.  Use publish() to replace
+     * the rules of an engine that is ticking.
+     */
+    RuleSet& getMutableRuleSet() { return rule_set; }
+
+    /** Replace all rules with a RuleSet built elsewhere.
+     *
+     * This may be called from any thread, also while another thread is
+     * ticking this engine.  The engine switches to the RuleSet at the start
+     * of its next getBestDecision, see adoptRules(), and keeps the raised
+     * Events.  The previous RuleSet is freed by a later publish(), so the
+     * ticking thread does not spend time on it.  Decisions returned by
+     * getBestDecision stay valid as long as they are held.  The RuleSet
+     * keeps its own adaptive ordering period and baked splines, so call
+     * RuleSet::setAdaptiveOrdering and RuleSet::bakeSplines while building.
+     *
+     * Considerations of the new RuleSet may read the Inputs of this engine,
+     * but addInput should not be called while the engine is ticking.
+     */
+    void publish(std::unique_ptr<RuleSet> rules) {
+      exchange.publish(std::move(rules));
+    }
+
+    /** Switch to the last published RuleSet, if there is one.
+     *
+     * Returns whether the rules were replaced.  getBestDecision calls this
+     * first, so there is no need to call it yourself.
+     */
+    bool adoptRules() {
+      RuleSet* published = exchange.take();
+      if (published == nullptr) {
+        return false;
+      }
+      rule_set.swap(*published);
+      exchange.retire(published);
+      snapshots.clear();
+      active_rules.clear();
+      active_rules.reserve(rule_set.getRuleCount());
+      active_events.reserve(rule_set.getEventCount());
+      active_events.forEach([this](Event e) { activate(e); });
+      reserveScratch();
+      recordNames();
+      if (input_recorder) {
+        input_recorder->attach(rule_set);
+      }
+#if defined(BHUMAN) && BHUMAN
+      initializeActivationGraph();
+#endif
+      return true;
     }
 
     /** Select the Decision with the highest score, and run its Action. */
@@ -177,140 +732,691 @@ class DecisionEngine {
       getBestDecision()->execute();
     }
 
+    /** Like executeBestDecision, but reports instead of throwing when no
+     *  Decision is selected.  The Action ran if the result holds one. */
+    SelectionResult tryExecuteBestDecision() {
+      const SelectionResult result = tryGetBestDecision();
+      if (result) {
+        rule_set.getDecision(result.handle)->execute();
+      }
+      return result;
+    }
+
     /** Select the Decision with the highest score.
      *
      * It should run as lazy as possible.  There is probably some
-     * optimization to squeeze out of here.
+     * optimization to squeeze out of here.  Every call starts a new tick for
+     * the InputChannels, so shared inputs are computed again.
+     *
+     * Throws a DecisionException when no Decision is selected, see
+     * tryGetBestDecision.
      */
     std::shared_ptr<Decision> getBestDecision() {
-      if (!updated_events.empty()) {
-        sort_decisions();
+      const SelectionResult result = tryGetBestDecision();
+      if (!result) {
+        BEHAVIOR_ENGINE_THROW(DecisionException(toString(result.reason)));
+      }
+      return rule_set.getDecision(result.handle);
+    }
+
+    /** Select the Decision with the highest score, without throwing.
+     *
+     * Selects the same Decision as getBestDecision.  When there is none, the
+     * result tells why: no Decisions are loaded, or all of them scored 0.
+     * Both are normal during a match, so this is the one to call every
+     * tick, and the one that works without exceptions.
+     */
+    SelectionResult tryGetBestDecision() {
+      return select(Clock::time_point::max());
+    }
+
+    /** Select the best Decision that can be found before a deadline,
+     *  without throwing.  See getBestDecision(Clock::time_point). */
+    SelectionResult tryGetBestDecision(Clock::time_point deadline) {
+      return select(deadline);
+    }
+
+    /** Rank the k Decisions with the highest scores, in one scan.
+     *
+     * ranked gets at most k Decisions that score above 0, best first, with
+     * their scores.  Ties are ranked like getBestDecision breaks them, so
+     * the first one is the Decision that it would select, and the result
+     * is that of tryGetBestDecision.
+     *
+     * The scan is that of getBestDecision, but it only skips and stops at
+     * what cannot beat the k-th best score so far.  For a small k that
+     * costs little more than getBestDecision.  It scores sequentially, also
+     * with a ThreadPool.  k is at least 1.
+     */
+    SelectionResult tryGetBestDecisions(size_t k, std::vector<RankedDecision>& ranked) {
+      adoptRules();
+      input_channels.invalidate();
+      beginRecording();
+      ranked.clear();
+      SelectionResult result;
+      if (active_rules.empty()) {
+        endRecording(0.f, 0, true);
+        result.reason = SelectionReason::NoActiveRules;
+        return result;
+      }
+      const size_t updated = selectBestDecisions(std::max<size_t>(k, 1));
+      if (candidates.empty()) {
+        endRecording(0.f, 0, true);
+        result.reason = SelectionReason::NoPositiveScore;
+        return result;
+      }
+      const Candidate& best = candidates.front();
+      endRecording(best.score, best.index, true);
+      for (const Candidate& candidate : candidates) {
+        ranked.push_back(RankedDecision{std::get<1>(active_rules[candidate.index]), candidate.score});
+      }
+#if defined(BHUMAN) && BHUMAN
+      activation_graph.get().bestDecisionIndex = best.index;
+      finalizeUpdateActivationGraphFromDecision(updated);
+#else
+      (void) updated;
+#endif
+      result.handle = ranked.front().handle;
+      result.score = best.score;
+      result.reason = SelectionReason::Selected;
+      return result;
+    }
+
+    /** Select the best Decision that can be found before a deadline.
+     *
+     * Decisions are visited in the same order as by getBestDecision(): most
+     * promising first, on UtilityScore and then on upper bound.  The clock
+     * is checked before scoring each Decision, so the deadline is overrun
+     * by at most one Decision.  Scoring is sequential, also with a
+     * ThreadPool.
+     *
+     * When the search completes, this throws in the same cases as
+     * getBestDecision().  When the deadline passes first, the result holds
+     * the best Decision so far, which may be nullptr.
+     */
+    AnytimeSelection getBestDecision(Clock::time_point deadline) {
+      const SelectionResult result = tryGetBestDecision(deadline);
+      if (!result && result.reason != SelectionReason::OutOfTime) {
+        BEHAVIOR_ENGINE_THROW(DecisionException(toString(result.reason)));
+      }
+      AnytimeSelection selection;
+      if (result) {
+        selection.decision = rule_set.getDecision(result.handle);
+      }
+      selection.score = result.score;
+      selection.complete = result.complete;
+      return selection;
+    }
+
+    /** Select the best Decision that can be found within a time budget. */
+    AnytimeSelection getBestDecision(Clock::duration budget) {
+      return getBestDecision(Clock::now() + budget);
+    }
+
+    /** Copy the profile counters of all Decisions into profile.
+     *
+     * The counters are only collected when BEHAVIOR_ENGINE_PROFILE is set.
+     * Decisions appear in the order they were added.  Reusing the same
+     * vector every frame avoids allocations once it has grown.
+     */
+    void collectProfile(std::vector<DecisionProfile>& profile) const {
+      profile.resize(rule_set.getDecisionCount());
+      for (DecisionHandle handle = 0; handle < profile.size(); ++handle) {
+        const Decision& decision = *rule_set.getDecision(handle);
+        DecisionProfile& entry = profile[handle];
+        entry.name = decision.getName();
+        entry.counters = decision.getProfile();
+        entry.considerations.resize(decision.getConsiderations().size());
+        for (size_t i = 0; i < entry.considerations.size(); ++i) {
+          const Consideration& consideration = decision.getConsiderations()[i];
+          entry.considerations[i].description = consideration.getDescription();
+          entry.considerations[i].counters = consideration.getProfile();
+        }
+      }
+    }
+
+    /** Set all profile counters to zero. */
+    void resetProfile() {
+      for (DecisionHandle handle = 0; handle < rule_set.getDecisionCount(); ++handle) {
+        const Decision& decision = *rule_set.getDecision(handle);
+        decision.getProfile() = ProfileCounters();
+        for (const Consideration& consideration : decision.getConsiderations()) {
+          consideration.getProfile() = ProfileCounters();
+        }
+      }
+    }
+
+    /** Return a list of all Decisions which the Engine could use. */
+    std::vector<std::shared_ptr<Decision>> getActiveDecisions() {
+      std::vector<std::shared_ptr<Decision>> actives;
+      actives.reserve(active_rules.size());
+      for (auto& rule : active_rules) {
+        actives.emplace_back(rule_set.getDecision(std::get<1>(rule)));
+      }
+      return actives;
+    }
+
+#if defined(BHUMAN) && BHUMAN
+    DecisionEngine()
+      : activation_graph(dummy_activation_graph)
+    {
+    }
+
+    DecisionEngine(ActivationGraph& a)
+      : activation_graph(a)
+    {
+    }
+
+    void setActivationGraph(ActivationGraph& a)
+    {
+      activation_graph = std::reference_wrapper<ActivationGraph>(a);
+    }
+
+    ActivationGraph getActivationGraph() {
+      return activation_graph;
+    }
+#endif
+
+  protected:
+    using Rule = std::tuple<Event, DecisionHandle>;
+
+    RuleSet rule_set;
+    RuleSetExchange exchange;
+    /** Loaded Decisions, sorted on UtilityScore and upper bound. */
+    std::vector<Rule> active_rules;
+    EventSet<Event> active_events;
+    /** Cached active_rules for combinations of raised Events.
+     *
+     * The entry for the current mask, if any, holds stale contents: it is
+     * the slot that active_rules goes back into when the mask changes.
+     */
+    std::map<EventMask, std::vector<Rule>> snapshots;
+    size_t snapshot_limit = 0;
+    InputChannels input_channels;
+    std::shared_ptr<ThreadPool> thread_pool;
+    std::shared_ptr<FlightRecorder> flight_recorder;
+    std::shared_ptr<InputRecorder> input_recorder;
+
+    SelectionMode selection_mode = SelectionMode::Best;
+    float selection_margin = 0.f;
+    std::mt19937 random_engine;
+
+    // Scratch space of selectBestDecisionInParallel().
+    /** Indices into active_rules of the Decisions of a tier to score. */
+    std::vector<size_t> jobs;
+    std::vector<float> scores;
+    /** For each Decision, the last tick it was scored in.  Also used by
+     *  selectWithinMargin(). */
+    std::vector<unsigned long> scored_in;
+    unsigned long scan_tick = 0;
+
+    /** A Decision in the ranking of selectBestDecisions(), or one to pick
+     *  from in selectWithinMargin(). */
+    struct Candidate {
+      float score;
+      /** Index into active_rules. */
+      size_t index;
+    };
+    /** Heap of the best Decisions so far, with the worst on top.  After
+     *  selectBestDecisions() it is sorted, best first. */
+    std::vector<Candidate> candidates;
+    /** Prefix sums of the scores of the candidates, see pickCandidate(). */
+    std::vector<float> weights;
+#if defined(BHUMAN) && BHUMAN
+    std::reference_wrapper<ActivationGraph> activation_graph;
+    ActivationGraph dummy_activation_graph;
+#endif
+
+    /** Load a new Decision right away for the events that are raised.
+     *
+     * This also reserves all storage that raiseEvent and clearEvent need
+     * later on.
+     */
+    void load(DecisionHandle handle, const events& e) {
+      for (auto event : e) {
+        if (active_events.contains(event)) {
+          activate(event, handle);
+        }
       }
+      // Enough room to raise every known Event at once.
+      active_rules.reserve(rule_set.getRuleCount());
+      active_events.reserve(rule_set.getEventCount());
+      reserveScratch();
+      recordNames();
+      if (input_recorder) {
+        input_recorder->attach(rule_set);
+      }
+      snapshots.clear();
+    }
+
+    /** Size the scratch space of the scans to the rules. */
+    void reserveScratch() {
+      const bool weighted = selection_mode == SelectionMode::WeightedRandom;
+      if (thread_pool) {
+        jobs.reserve(rule_set.getRuleCount());
+        scores.resize(rule_set.getRuleCount());
+      }
+      if (thread_pool || weighted) {
+        scored_in.resize(rule_set.getDecisionCount(), 0);
+      }
+      if (weighted) {
+        candidates.reserve(rule_set.getDecisionCount());
+        weights.reserve(rule_set.getDecisionCount());
+      }
+    }
+
+    /** tryGetBestDecision.  A deadline other than Clock::time_point::max()
+     *  scores sequentially, also with a ThreadPool. */
+    SelectionResult select(Clock::time_point deadline) {
+      adoptRules();
+      input_channels.invalidate();
+      beginRecording();
+      SelectionResult result;
       if (active_rules.empty()) {
-        throw DecisionException("Empty active rule set");
+        endRecording(0.f, 0, true);
+        result.reason = SelectionReason::NoActiveRules;
+        return result;
       }
-      float highest_score = 0.f;
       size_t best_index = 0;
+      // Index of the first rule that the activation graph was not updated for.
+      size_t updated;
+      if (selection_mode == SelectionMode::WeightedRandom && selection_margin > 0.f) {
+        updated = selectWithinMargin(result.score, deadline, result.complete) + 1;
+        if (bool(result.score)) {
+          const Candidate& picked = pickCandidate(result.score);
+          result.score = picked.score;
+          best_index = picked.index;
+        }
+      } else if (thread_pool && deadline == Clock::time_point::max()) {
+        updated = selectBestDecisionInParallel(result.score, best_index);
+      } else {
+        updated = selectBestDecision(result.score, best_index, deadline, result.complete) + 1;
+      }
+      endRecording(result.score, best_index, result.complete);
+      if (!bool(result.score)) {
+        result.reason = result.complete ? SelectionReason::NoPositiveScore : SelectionReason::OutOfTime;
+        return result;
+      }
+#if defined(BHUMAN) && BHUMAN
+      activation_graph.get().bestDecisionIndex = best_index;
+      finalizeUpdateActivationGraphFromDecision(updated);
+#else
+      (void) updated;
+#endif
+      result.handle = std::get<1>(active_rules[best_index]);
+      result.reason = SelectionReason::Selected;
+      return result;
+    }
 
+    /** The loop of getBestDecision, which stops at the deadline.
+     *
+     * Returns the index at which it stopped, and sets complete to whether
+     * it got there without running out of time.
+     */
+    size_t selectBestDecision(float& highest_score, size_t& best_index,
+        Clock::time_point deadline, bool& complete)
+    {
+      const bool adaptive = rule_set.getAdaptiveOrdering() > 0;
+      const bool timed = deadline != Clock::time_point::max();
+      complete = true;
       size_t i = 0;
       for (; i < active_rules.size(); ++i) {
-        std::shared_ptr<const Decision> decision = std::get<1>(active_rules[i]);
-        float utility = static_cast<float>(decision->getUtility());
-#ifdef NDEBUG
-        std::cout << "  Computing Decision '" << decision->getName() << "', utility: " << utility << "\n";
+        const DecisionHandle handle = std::get<1>(active_rules[i]);
+        const RuleSet::Summary& summary = rule_set.getSummary(handle);
+        float utility = summary.utility;
+#if BEHAVIOR_ENGINE_TRACE
+        std::cout << "  Computing Decision '" << summary.decision->getName() << "', utility: " << utility << "\n";
 #endif
         // Because active_rules is sorted and because for any score s holds
         // 0 <= s <= 1, we are guaranteed not to find
         if (utility < highest_score || !bool(utility)) {
-#ifdef NDEBUG
+#if BEHAVIOR_ENGINE_TRACE
           std::cout << "    Ignoring this one: ";
           if (!bool(utility)) std::cout << "utility = 0\n";
           else std::cout << "utility < highest\n";
 #endif
           break;
         }
-        float score = decision->computeScore();
+        // Within a tier, Decisions are sorted on their upper bound, so the
+        // most promising ones raise highest_score early, and the others are
+        // skipped or abandoned halfway by computeScore(highest_score).
+        if (summary.upper_bound <= highest_score) {
+#if BEHAVIOR_ENGINE_TRACE
+          std::cout << "    Skipping this one: upper bound <= highest\n";
+#endif
+          BEHAVIOR_ENGINE_PROFILE_SKIP(summary.decision->getProfile());
+#if defined(BHUMAN) && BHUMAN
+          updateActivationGraph(i, DEFAULT_SCORE);
+#endif
+          continue;
+        }
+        if (timed && Clock::now() >= deadline) {
+#if BEHAVIOR_ENGINE_TRACE
+          std::cout << "    Out of time\n";
+#endif
+          complete = false;
+          break;
+        }
+        const float threshold = highest_score;
+        float score = summary.decision->computeScore(threshold);
+        if (flight_recorder) {
+          flight_recorder->record(handle, score, threshold);
+        }
+        if (adaptive && summary.decision->adapt()) {
+          rule_set.refresh(handle);
+        }
 #if defined(BHUMAN) && BHUMAN
         updateActivationGraph(i, score);
 #endif
-#ifdef NDEBUG
+#if BEHAVIOR_ENGINE_TRACE
         std::cout << "    score: " << score << "\n";
 #endif
         if (score > highest_score) {
-#ifdef NDEBUG
+#if BEHAVIOR_ENGINE_TRACE
           std::cout << "    High score!\n";
 #endif
           highest_score = score;
           best_index = i;
           if (score >= utility) {
-#ifdef NDEBUG
+#if BEHAVIOR_ENGINE_TRACE
             std::cout << "    Can't do better than this. Quitting.\n";
 #endif
             break;
           }
         }
       }
-      if (!bool(highest_score)) {
-        throw DecisionException("No rule was activated");
-      }
+      return i;
+    }
+
+    /** The loop of getBestDecision in SelectionMode::WeightedRandom.
+     *
+     * Collects in candidates every Decision that scores above
+     * highest_score - selection_margin at the time.  Returns the index at
+     * which it stopped, and sets complete like selectBestDecision.
+     */
+    size_t selectWithinMargin(float& highest_score, Clock::time_point deadline, bool& complete) {
+      const bool adaptive = rule_set.getAdaptiveOrdering() > 0;
+      const bool timed = deadline != Clock::time_point::max();
+      complete = true;
+      candidates.clear();
+      ++scan_tick;
+      // A Decision has to score above cutoff to get within the margin.
+      float cutoff = 0.f;
+      size_t i = 0;
+      for (; i < active_rules.size(); ++i) {
+        const DecisionHandle handle = std::get<1>(active_rules[i]);
+        const RuleSet::Summary& summary = rule_set.getSummary(handle);
+        if (summary.utility <= cutoff) {
+          break;
+        }
+        // A Decision that is loaded by several Events is a candidate once.
+        if (summary.upper_bound <= cutoff || scored_in[handle] == scan_tick) {
+          BEHAVIOR_ENGINE_PROFILE_SKIP(summary.decision->getProfile());
 #if defined(BHUMAN) && BHUMAN
-      activation_graph.get().bestDecisionIndex = best_index;
-      finalizeUpdateActivationGraphFromDecision(i + 1);
+          updateActivationGraph(i, DEFAULT_SCORE);
+#endif
+          continue;
+        }
+        if (timed && Clock::now() >= deadline) {
+          complete = false;
+          break;
+        }
+        scored_in[handle] = scan_tick;
+        const float score = summary.decision->computeScore(cutoff);
+        if (flight_recorder) {
+          flight_recorder->record(handle, score, cutoff);
+        }
+        if (adaptive && summary.decision->adapt()) {
+          rule_set.refresh(handle);
+        }
+#if defined(BHUMAN) && BHUMAN
+        updateActivationGraph(i, score);
 #endif
-      return std::get<1>(active_rules[best_index]);
+        if (score > cutoff) {
+          candidates.push_back(Candidate{score, i});
+          if (score > highest_score) {
+            highest_score = score;
+            cutoff = std::max(0.f, score - selection_margin);
+          }
+        }
+      }
+      return i;
     }
 
-    /** Return a list of all Decisions which the Engine could use. */
-    std::vector<std::shared_ptr<Decision>> getActiveDecisions() {
-      std::vector<std::shared_ptr<Decision>> actives;
-      actives.reserve(active_rules.size());
-      for (auto& rule : active_rules) {
-        actives.emplace_back(std::get<1>(rule));
+    /** Pick one of the candidates within selection_margin of highest_score,
+     *  with a chance proportional to its score. */
+    const Candidate& pickCandidate(float highest_score) {
+      const float cutoff = highest_score - selection_margin;
+      candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+            [cutoff](const Candidate& candidate) { return candidate.score <= cutoff; }),
+          candidates.end());
+      weights.clear();
+      float total = 0.f;
+      for (const Candidate& candidate : candidates) {
+        total += candidate.score;
+        weights.push_back(total);
       }
-      return actives;
+      const float x = std::uniform_real_distribution<float>(0.f, total)(random_engine);
+      const size_t picked = static_cast<size_t>(
+          std::upper_bound(weights.begin(), weights.end(), x) - weights.begin());
+      return candidates[std::min(picked, candidates.size() - 1)];
+    }
+
+    /** Whether Candidate a ranks above b: getBestDecision prefers the first
+     *  of equal scores. */
+    static bool ranksAbove(const Candidate& a, const Candidate& b) {
+      return a.score > b.score || (a.score == b.score && a.index < b.index);
     }
 
+    /** The loop of getBestDecision, keeping the k best Decisions in
+     *  candidates.  Returns the index at which it stopped. */
+    size_t selectBestDecisions(size_t k) {
+      const bool adaptive = rule_set.getAdaptiveOrdering() > 0;
+      candidates.clear();
+      candidates.reserve(k);
+      // The score to beat: 0 until there are k candidates, then the k-th best.
+      float threshold = 0.f;
+      size_t i = 0;
+      for (; i < active_rules.size(); ++i) {
+        const DecisionHandle handle = std::get<1>(active_rules[i]);
+        const RuleSet::Summary& summary = rule_set.getSummary(handle);
+        if (summary.utility < threshold || !bool(summary.utility)) {
+          break;
+        }
+        if (summary.upper_bound <= threshold) {
+          BEHAVIOR_ENGINE_PROFILE_SKIP(summary.decision->getProfile());
 #if defined(BHUMAN) && BHUMAN
-    DecisionEngine()
-      : activation_graph(dummy_activation_graph)
-    {
+          updateActivationGraph(i, DEFAULT_SCORE);
+#endif
+          continue;
+        }
+        const float score = summary.decision->computeScore(threshold);
+        if (flight_recorder) {
+          flight_recorder->record(handle, score, threshold);
+        }
+        if (adaptive && summary.decision->adapt()) {
+          rule_set.refresh(handle);
+        }
+#if defined(BHUMAN) && BHUMAN
+        updateActivationGraph(i, score);
+#endif
+        if (score <= threshold || isCandidate(handle)) {
+          continue;
+        }
+        if (candidates.size() == k) {
+          std::pop_heap(candidates.begin(), candidates.end(), ranksAbove);
+          candidates.pop_back();
+        }
+        candidates.push_back(Candidate{score, i});
+        std::push_heap(candidates.begin(), candidates.end(), ranksAbove);
+        if (candidates.size() == k) {
+          threshold = candidates.front().score;
+        }
+      }
+      std::sort_heap(candidates.begin(), candidates.end(), ranksAbove);
+      return i;
     }
 
-    DecisionEngine(ActivationGraph& a)
-      : activation_graph(a)
-    {
+    /** Whether a Decision that is loaded by several Events already is
+     *  one of the candidates. */
+    bool isCandidate(DecisionHandle handle) const {
+      for (const Candidate& candidate : candidates) {
+        if (std::get<1>(active_rules[candidate.index]) == handle) {
+          return true;
+        }
+      }
+      return false;
     }
 
-    void setActivationGraph(ActivationGraph& a)
-    {
-      activation_graph = std::reference_wrapper<ActivationGraph>(a);
+    /** The loop of getBestDecision, with each tier scored on the
+     *  thread_pool.  Returns the index at which it stopped. */
+    size_t selectBestDecisionInParallel(float& highest_score, size_t& best_index) {
+      const bool adaptive = rule_set.getAdaptiveOrdering() > 0;
+      ++scan_tick;
+
+      size_t i = 0;
+      while (i < active_rules.size()) {
+        const float utility = rule_set.getSummary(std::get<1>(active_rules[i])).utility;
+        if (utility < highest_score || !bool(utility)) {
+          break;
+        }
+        // Collect the Decisions of this tier that could beat highest_score.
+        // A Decision that is loaded by several Events is scored once.
+        jobs.clear();
+        size_t end = i;
+        for (; end < active_rules.size(); ++end) {
+          const DecisionHandle handle = std::get<1>(active_rules[end]);
+          const RuleSet::Summary& summary = rule_set.getSummary(handle);
+          if (summary.utility != utility) {
+            break;
+          }
+          const bool bounded = summary.upper_bound <= highest_score;
+          if (bounded) {
+            BEHAVIOR_ENGINE_PROFILE_SKIP(summary.decision->getProfile());
+          }
+          if (bounded || scored_in[handle] == scan_tick) {
+#if defined(BHUMAN) && BHUMAN
+            updateActivationGraph(end, DEFAULT_SCORE);
+#endif
+            continue;
+          }
+          scored_in[handle] = scan_tick;
+          jobs.push_back(end);
+        }
+        const float threshold = highest_score;
+        // Each job refreshes the Summary of its own Decision only.
+        auto score = [this, threshold, adaptive](size_t j) {
+          const DecisionHandle handle = std::get<1>(active_rules[jobs[j]]);
+          Decision& decision = *rule_set.getSummary(handle).decision;
+          scores[j] = decision.computeScore(threshold);
+          if (adaptive && decision.adapt()) {
+            rule_set.refresh(handle);
+          }
+        };
+        thread_pool->parallelFor(jobs.size(), score);
+        // Reduce in the order of active_rules, so the first one wins ties.
+        for (size_t j = 0; j < jobs.size(); ++j) {
+#if defined(BHUMAN) && BHUMAN
+          updateActivationGraph(jobs[j], scores[j]);
+#endif
+          if (flight_recorder) {
+            flight_recorder->record(std::get<1>(active_rules[jobs[j]]), scores[j], threshold);
+          }
+          if (scores[j] > highest_score) {
+            highest_score = scores[j];
+            best_index = jobs[j];
+          }
+        }
+        i = end;
+        if (highest_score >= utility) {
+          break;
+        }
+      }
+      return i;
     }
 
-    ActivationGraph getActivationGraph() {
-      return activation_graph;
+    /** Start a tick in the flight_recorder, if any. */
+    void beginRecording() {
+      if (flight_recorder) {
+        flight_recorder->begin(active_events.mask(), !active_events.isDense());
+      }
     }
-#endif
 
-  protected:
-    using Rule = std::tuple<Event, std::shared_ptr<Decision>>;
+    /** Finish the tick in the flight_recorder and input_recorder, if any. */
+    void endRecording(float highest_score, size_t best_index, bool complete) {
+      if (input_recorder) {
+        input_recorder->endTick(active_events);
+      }
+      if (flight_recorder) {
+        const uint32_t chosen = bool(highest_score)
+          ? static_cast<uint32_t>(std::get<1>(active_rules[best_index]))
+          : flight::NO_DECISION;
+        flight_recorder->end(chosen, highest_score, complete);
+      }
+    }
 
-    std::map<Event, std::vector<Decision>> rules;
-    std::vector<Rule> active_rules;
-    std::set<Event> active_events;
-    std::set<Event> updated_events;
-#if defined(BHUMAN) && BHUMAN
-    std::reference_wrapper<ActivationGraph> activation_graph;
-    ActivationGraph dummy_activation_graph;
-#endif
+    /** Write the names of the Decisions to the flight_recorder. */
+    void recordNames() {
+      if (flight_recorder) {
+        flight_recorder->setNames(rule_set.getDecisionCount(),
+            [this](size_t handle) -> const std::string& {
+              return rule_set.getDecision(handle)->getName();
+            });
+      }
+    }
 
-    /** Sort Decisions in rules and active_rules based on their UtilityScore.
+    /** Swap in the cached active_rules for the raised Events.
      *
-     * It only sorts the containers which have been updated since the last
-     * invocation of sort_decisions().
+     * Called after active_events changed from the set with mask from.  The
+     * current active_rules is cached under that mask first.  Returns false
+     * if the new combination was never seen, in which case active_rules is
+     * left as it was, for the caller to update.
      */
-    void sort_decisions() {
-      bool do_sort_active_decisions = false;
-      for (auto& event : updated_events) {
-        std::stable_sort(rules[event].begin(), rules[event].end(),
-            [](const Decision& x, const Decision& y) {
-                return x.getUtility() > y.getUtility();
-            });
-        if (!do_sort_active_decisions && active_events.find(event) != active_events.end()) {
-          do_sort_active_decisions = true;
-        }
-        if (do_sort_active_decisions) {
-          sort_active_decisions();
+    bool switchSnapshot(bool was_dense, EventMask from) {
+      if (snapshot_limit == 0) {
+        return false;
+      }
+      auto to = active_events.isDense() ? snapshots.find(active_events.mask()) : snapshots.end();
+      if (was_dense) {
+        auto stored = snapshots.find(from);
+        if (stored == snapshots.end()) {
+          if (snapshots.size() >= snapshot_limit) {
+            snapshots.clear();
+            to = snapshots.end();
+          }
+          stored = snapshots.emplace(from, std::vector<Rule>()).first;
+          stored->second = active_rules;
+        } else if (to != snapshots.end()) {
+          stored->second.swap(active_rules);
+        } else {
+          stored->second = active_rules;
         }
       }
-      updated_events.clear();
+      if (to == snapshots.end()) {
+        active_rules.reserve(rule_set.getRuleCount());
+        return false;
+      }
+      active_rules.swap(to->second);
+      return true;
     }
 
-    /** Sorts active decisions based on their UtilityScore. */
-    void sort_active_decisions() {
-      std::stable_sort(active_rules.begin(), active_rules.end(),
-          [](const Rule& x, const Rule& y) {
-              return std::get<1>(x)->getUtility() > std::get<1>(y)->getUtility();
+    /** Insert a Decision into active_rules, behind its equals. */
+    void activate(Event e, DecisionHandle handle) {
+      auto position = std::upper_bound(active_rules.begin(), active_rules.end(), handle,
+          [this](DecisionHandle x, const Rule& y) {
+            return rule_set.precedes(x, std::get<1>(y));
           });
+      active_rules.emplace(position, e, handle);
+    }
+
+    /** Insert all Decisions of an Event into active_rules. */
+    void activate(Event e) {
+      const std::vector<DecisionHandle>* handles = rule_set.getRules(e);
+      if (handles != nullptr) {
+        for (DecisionHandle handle : *handles) {
+          activate(e, handle);
+        }
+      }
     }
 
 #if defined(BHUMAN) && BHUMAN
@@ -318,7 +1424,7 @@ class DecisionEngine {
         activation_graph.get().dlist.clear();
         activation_graph.get().dlist.reserve(active_rules.size());
         for (size_t i = 0; i < active_rules.size(); i++) {
-            activation_graph.get().dlist.emplace_back(std::get<1>(active_rules[i])->getName(), DEFAULT_SCORE);
+            activation_graph.get().dlist.emplace_back(rule_set.getDecision(std::get<1>(active_rules[i]))->getName(), DEFAULT_SCORE);
         }
     }
 
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/** Bitmask of the enum values below 64, see EventSet. */
+using EventMask = uint64_t;
+
+/** A set of enum values, kept in a single word where possible.
+ *
+ * Events are usually a small enum, so values below 64 are stored as bits
+ * of an EventMask: testing, adding and removing them are a few
+ * instructions, and the mask identifies the whole set.  Larger values are
+ * kept in a sorted vector.
+ */
+template<class E>
+class EventSet {
+  public:
+    static constexpr size_t dense_size = 64;
+
+    /** Whether e is stored as a bit. */
+    static bool isDense(E e) {
+      return static_cast<uint64_t>(static_cast<typename std::underlying_type<E>::type>(e)) < dense_size;
+    }
+
+    static EventMask bit(E e) {
+      return EventMask(1) << static_cast<typename std::underlying_type<E>::type>(e);
+    }
+
+    bool contains(E e) const {
+      if (isDense(e)) {
+        return (mask_ & bit(e)) != 0;
+      }
+      return std::binary_search(sparse_.begin(), sparse_.end(), e);
+    }
+
+    /** Add e.  Returns false if it already was in the set. */
+    bool insert(E e) {
+      if (isDense(e)) {
+        const EventMask previous = mask_;
+        mask_ |= bit(e);
+        return mask_ != previous;
+      }
+      auto position = std::lower_bound(sparse_.begin(), sparse_.end(), e);
+      if (position != sparse_.end() && *position == e) {
+        return false;
+      }
+      sparse_.insert(position, e);
+      return true;
+    }
+
+    /** Remove e.  Returns false if it was not in the set. */
+    bool erase(E e) {
+      if (isDense(e)) {
+        const EventMask previous = mask_;
+        mask_ &= ~bit(e);
+        return mask_ != previous;
+      }
+      auto position = std::lower_bound(sparse_.begin(), sparse_.end(), e);
+      if (position == sparse_.end() || *position != e) {
+        return false;
+      }
+      sparse_.erase(position);
+      return true;
+    }
+
+    void clear() {
+      mask_ = 0;
+      sparse_.clear();
+    }
+
+    bool empty() const { return mask_ == 0 && sparse_.empty(); }
+
+    /** Whether all values are bits, so that mask() identifies the set. */
+    bool isDense() const { return sparse_.empty(); }
+
+    EventMask mask() const { return mask_; }
+
+    /** Make room for n values of 64 and up. */
+    void reserve(size_t n) { sparse_.reserve(n); }
+
+    /** Call f for every value, in ascending order. */
+    template<class F>
+    void forEach(F f) const {
+      for (EventMask bits = mask_; bits != 0; bits &= bits - 1) {
+        f(static_cast<E>(lowest(bits)));
+      }
+      for (E e : sparse_) {
+        f(e);
+      }
+    }
+
+  private:
+    EventMask mask_ = 0;
+    std::vector<E> sparse_;
+
+    static unsigned int lowest(EventMask bits) {
+      unsigned int index = 0;
+      while (!(bits & 1)) {
+        bits >>= 1;
+        ++index;
+      }
+      return index;
+    }
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/** 1 when exceptions are enabled, 0 when building with -fno-exceptions.
+ *
+ * Without exceptions, every error that would throw prints its message and
+ * aborts instead.  The per-tick API has functions that report instead of
+ * throw, such as DecisionEngine::tryGetBestDecision.
+ */
+#ifndef BEHAVIOR_ENGINE_EXCEPTIONS
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define BEHAVIOR_ENGINE_EXCEPTIONS 1
+#else
+#define BEHAVIOR_ENGINE_EXCEPTIONS 0
+#endif
+#endif
+
+#if BEHAVIOR_ENGINE_EXCEPTIONS
+#define BEHAVIOR_ENGINE_THROW(EXCEPTION) throw EXCEPTION
+#else
+#define BEHAVIOR_ENGINE_THROW(EXCEPTION) detail::abortWith((EXCEPTION).what())
+
+namespace detail {
+  [[noreturn]] inline void abortWith(const char* message) {
+    std::fprintf(stderr, "%s\n", message);
+    std::abort();
+  }
+}
+#endif
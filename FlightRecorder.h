@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Exceptions.h"
+
+/** Layout of the file written by FlightRecorder.
+ *
+ * The file starts with a Header, followed by the names of the Decisions
+ * (NUL-terminated, in DecisionHandle order) and by slot_count slots of
+ * slot_size bytes.  Tick t is stored in slot (t - 1) % slot_count.  A slot
+ * is a Slot followed by up to max_decisions Entries.  Its tick field is
+ * written last and is 0 while the slot is being written, so a reader can
+ * tell complete slots apart after a crash.  All fields are in host byte
+ * order.
+ */
+namespace flight {
+  constexpr uint32_t MAGIC = 0x52464542;  // "BEFR"
+  constexpr uint32_t VERSION = 2;
+  /** Slot::chosen when no Decision was chosen. */
+  constexpr uint32_t NO_DECISION = 0xffffffff;
+  /** Set in Entry::decision when scoring stopped early, because the
+   *  Decision could not beat Entry::score. */
+  constexpr uint32_t PRUNED = 0x80000000;
+
+  enum SlotFlags : uint32_t {
+    /** Some raised Events are 64 or up, and are missing from event_mask. */
+    SPARSE_EVENTS = 1,
+    /** More than max_decisions Decisions were scored. */
+    TRUNCATED = 2,
+    /** The search stopped at a deadline. */
+    INCOMPLETE = 4,
+  };
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t max_decisions;
+    uint32_t names_capacity;
+    uint32_t names_size;
+    uint32_t reserved;
+    uint64_t names_offset;
+    uint64_t slots_offset;
+    /** Number of ticks recorded so far. */
+    uint64_t ticks;
+  };
+
+  struct Slot {
+    /** 1 for the first tick. */
+    uint64_t tick;
+    /** steady_clock time at the end of the tick, in ns. */
+    int64_t timestamp;
+    uint64_t event_mask;
+    uint32_t chosen;
+    float best_score;
+    uint32_t count;
+    uint32_t flags;
+  };
+
+  /** A Decision that was scored, in the order they were scored.
+   *
+   * If decision has the PRUNED bit, score is the threshold that the
+   * Decision could not beat, not its score.
+   */
+  struct Entry {
+    uint32_t decision;
+    float score;
+  };
+
+  static_assert(sizeof(Header) == 56, "Header layout");
+  static_assert(sizeof(Slot) == 40, "Slot layout");
+  static_assert(sizeof(Entry) == 8, "Entry layout");
+}
+
+/** Records every tick of a DecisionEngine into a memory-mapped ring file.
+ *
+ * Per tick it keeps the raised Events, every Decision that was scored with
+ * its score, the chosen Decision and a timestamp, in a fixed-size slot.
+ * Recording is a few stores into mapped memory, and the kernel writes the
+ * pages to the file, also when the process crashes.  The oldest ticks are
+ * overwritten.  Attach it with DecisionEngine::setFlightRecorder, and read
+ * the file with the behavior_engine_flight_decoder tool.
+ */
+class FlightRecorder {
+  public:
+    /** Create or truncate the file at path, and map it.
+     *
+     * Throws std::invalid_argument when slot_count or max_decisions is 0,
+     * or when a slot or the file would be too large, and
+     * std::runtime_error when the file cannot be created or mapped.
+     */
+    explicit FlightRecorder(const std::string& path,
+        uint32_t slot_count = 4096,
+        uint32_t max_decisions = 64,
+        uint32_t names_capacity = 64 * 1024)
+    {
+      if (slot_count == 0) {
+        BEHAVIOR_ENGINE_THROW(std::invalid_argument("A flight recorder needs at least one slot"));
+      }
+      if (max_decisions == 0) {
+        BEHAVIOR_ENGINE_THROW(std::invalid_argument("A flight recorder slot needs room for a Decision"));
+      }
+      const uint64_t slot_size = sizeof(flight::Slot) + uint64_t(max_decisions) * sizeof(flight::Entry);
+      const uint64_t names_offset = sizeof(flight::Header);
+      const uint64_t slots_offset = (names_offset + names_capacity + 63) / 64 * 64;
+      // Can only wrap when slot_size is 2^32 or more, which is rejected.
+      const uint64_t size = slots_offset + slot_size * slot_count;
+      if (slot_size > UINT32_MAX || static_cast<size_t>(size) != size
+          || size > uint64_t(std::numeric_limits<off_t>::max())) {
+        BEHAVIOR_ENGINE_THROW(std::invalid_argument("Flight recorder file too large for " + path));
+      }
+      size_ = static_cast<size_t>(size);
+      const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Cannot open flight recorder file " + path));
+      }
+      if (::ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+        ::close(fd);
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Cannot resize flight recorder file " + path));
+      }
+      void* memory = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (memory == MAP_FAILED) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Cannot map flight recorder file " + path));
+      }
+      memory_ = static_cast<char*>(memory);
+      header_ = reinterpret_cast<flight::Header*>(memory_);
+      header_->magic = flight::MAGIC;
+      header_->version = flight::VERSION;
+      header_->slot_count = slot_count;
+      header_->slot_size = static_cast<uint32_t>(slot_size);
+      header_->max_decisions = max_decisions;
+      header_->names_capacity = names_capacity;
+      header_->names_size = 0;
+      header_->names_offset = names_offset;
+      header_->slots_offset = slots_offset;
+      header_->ticks = 0;
+    }
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    ~FlightRecorder() {
+      ::munmap(memory_, size_);
+    }
+
+    /** Store the names of the Decisions, name(handle) for every handle
+     *  below count.  Names that do not fit are left out. */
+    template<class F>
+    void setNames(size_t count, F name) {
+      char* names = memory_ + header_->names_offset;
+      uint32_t size = 0;
+      for (size_t handle = 0; handle < count; ++handle) {
+        const std::string& n = name(handle);
+        if (size + n.size() + 1 > header_->names_capacity) {
+          break;
+        }
+        std::memcpy(names + size, n.c_str(), n.size() + 1);
+        size += static_cast<uint32_t>(n.size() + 1);
+      }
+      header_->names_size = size;
+    }
+
+    /** Start recording a tick. */
+    void begin(uint64_t event_mask, bool sparse_events) {
+      const uint64_t tick = header_->ticks + 1;
+      slot_ = reinterpret_cast<flight::Slot*>(memory_ + header_->slots_offset
+          + (tick - 1) % header_->slot_count * header_->slot_size);
+      entries_ = reinterpret_cast<flight::Entry*>(slot_ + 1);
+      slot_->tick = 0;
+      // Keep the compiler from moving the writes below above that.
+      std::atomic_signal_fence(std::memory_order_release);
+      slot_->event_mask = event_mask;
+      slot_->count = 0;
+      slot_->flags = sparse_events ? uint32_t(flight::SPARSE_EVENTS) : 0u;
+    }
+
+    /** Record the score of a Decision in the current tick.
+     *
+     * score is the result of Decision::computeScore(threshold).  If that is
+     * at most a positive threshold, it may be a bound instead of the score,
+     * and the Decision is recorded as flight::PRUNED at threshold.
+     */
+    inline void record(size_t decision, float score, float threshold = 0.f) {
+      if (slot_->count < header_->max_decisions) {
+        const bool pruned = threshold > 0.f && score <= threshold;
+        entries_[slot_->count].decision = static_cast<uint32_t>(decision)
+          | (pruned ? flight::PRUNED : 0u);
+        entries_[slot_->count].score = pruned ? threshold : score;
+        ++slot_->count;
+      } else {
+        slot_->flags |= flight::TRUNCATED;
+      }
+    }
+
+    /** Finish the current tick.  chosen is flight::NO_DECISION if none. */
+    void end(uint32_t chosen, float best_score, bool complete = true) {
+      slot_->chosen = chosen;
+      slot_->best_score = best_score;
+      if (!complete) {
+        slot_->flags |= flight::INCOMPLETE;
+      }
+      slot_->timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+      const uint64_t tick = header_->ticks + 1;
+      // Keep the compiler from moving the writes above below the tick.
+      std::atomic_signal_fence(std::memory_order_release);
+      slot_->tick = tick;
+      header_->ticks = tick;
+    }
+
+    uint64_t getTicks() const { return header_->ticks; }
+
+  private:
+    char* memory_ = nullptr;
+    size_t size_ = 0;
+    flight::Header* header_ = nullptr;
+    flight::Slot* slot_ = nullptr;
+    flight::Entry* entries_ = nullptr;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Consideration.h"
+
+/** A named input that is computed at most once per tick.
+ *
+ * Many Decisions look at the same quantity, such as the distance to the
+ * ball.  Registering it once as a channel with DecisionEngine::addInput and
+ * reading it through the returned Input lets every Consideration share a
+ * single evaluation of the underlying UtilityFunction.  The engine starts a
+ * new tick, and thereby invalidates all cached values, at the start of
+ * every getBestDecision.  Only channels that are read are computed, and a
+ * channel that several threads read at once in a tick is computed once.
+ */
+class InputChannel {
+  public:
+    InputChannel(const UtilityFunction& function, std::shared_ptr<const unsigned long> tick)
+      : function_(function),
+      tick_(tick)
+    {}
+
+    inline float operator()() {
+      const unsigned long tick = *tick_;
+      if (generation_.load(std::memory_order_acquire) != tick) {
+        compute(tick);
+      }
+      return value_;
+    }
+
+    void setFunction(const UtilityFunction& function) {
+      function_ = function;
+      generation_.store(0, std::memory_order_relaxed);
+    }
+
+  private:
+    UtilityFunction function_;
+    std::shared_ptr<const unsigned long> tick_;
+    /** The tick that value_ was computed in. */
+    std::atomic<unsigned long> generation_{0};
+    std::mutex mutex_;
+    float value_ = 0.f;
+
+    void compute(unsigned long tick) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (generation_.load(std::memory_order_relaxed) != tick) {
+        value_ = function_();
+        generation_.store(tick, std::memory_order_release);
+      }
+    }
+};
+
+/** Handle to an InputChannel, usable wherever a UtilityFunction is.
+ *
+ * Copies refer to the same channel, so an Input can be captured by value in
+ * any number of Considerations.
+ */
+class Input {
+  public:
+    Input() = default;
+    explicit Input(std::shared_ptr<InputChannel> channel) : channel_(channel) {}
+
+    inline float operator()() const { return (*channel_)(); }
+    explicit operator bool() const { return bool(channel_); }
+
+  private:
+    std::shared_ptr<InputChannel> channel_;
+};
+
+/** The named InputChannels of one engine, and the tick that guards them. */
+class InputChannels {
+  public:
+    InputChannels()
+      : tick_(std::make_shared<unsigned long>(1))
+    {}
+
+    /** Register a channel, or replace the function of an existing one.
+     *
+     * Inputs that were handed out for this name stay valid.
+     */
+    Input add(const std::string& name, const UtilityFunction& function) {
+      auto it = channels_.find(name);
+      if (it != channels_.end()) {
+        it->second->setFunction(function);
+        return Input(it->second);
+      }
+      auto channel = std::make_shared<InputChannel>(function, tick_);
+      channels_.emplace(name, channel);
+      return Input(channel);
+    }
+
+    /** The channel with this name, or an empty Input if there is none. */
+    Input get(const std::string& name) const {
+      auto it = channels_.find(name);
+      return it == channels_.end() ? Input() : Input(it->second);
+    }
+
+    bool contains(const std::string& name) const {
+      return channels_.find(name) != channels_.end();
+    }
+
+    /** Start a new tick: every channel recomputes on its next read.
+     *
+     * Not while the channels are being read.
+     */
+    void invalidate() { ++*tick_; }
+
+    void clear() { channels_.clear(); }
+
+  private:
+    std::shared_ptr<unsigned long> tick_;
+    std::map<std::string, std::shared_ptr<InputChannel>> channels_;
+};
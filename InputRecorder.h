@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Decision.h"
+#include "EventSet.h"
+#include "Exceptions.h"
+
+/** Format of the stream written by InputRecorder and read by InputReplay.
+ *
+ * The stream starts with MAGIC and VERSION as two uint32_t, followed by
+ * records that each start with a Record byte:
+ *
+ *  - KEY: uint32_t id, uint32_t length and the characters of the key of a
+ *    Consideration, see forEachInput.  Comes before the first use of id.
+ *  - EVENTS: uint32_t count and count raised Events as uint32_t.  Written
+ *    when the raised Events changed since the previous tick.
+ *  - TICK: uint32_t count and count pairs of uint32_t id and float value.
+ *    Ends a tick, and holds the values that changed since the previous one.
+ *
+ * All fields are in host byte order.
+ */
+namespace tape {
+  constexpr uint32_t MAGIC = 0x54494542;  // "BEIT"
+  constexpr uint32_t VERSION = 1;
+
+  enum Record : uint8_t {
+    KEY = 'K',
+    EVENTS = 'E',
+    TICK = 'T',
+  };
+
+  /** Call f(decision, index, key) for every Consideration of rules.
+   *
+   * The key of a Consideration is the name of its Decision and its
+   * description, separated by a slash.  Keys are unique within rules:
+   * when several Considerations get the same key, in the same or in
+   * different Decisions of the same name, the later ones in DecisionHandle
+   * order get "#2", "#3" and so on appended.  Keys identify the same input
+   * in a changed rule set, as long as the Decision and Consideration keep
+   * their names, and Decisions of the same name keep their order.
+   */
+  template<class Rules, class F>
+  void forEachInput(Rules& rules, F f) {
+    std::map<std::string, unsigned int> seen;
+    for (size_t handle = 0; handle < rules.getDecisionCount(); ++handle) {
+      Decision& decision = *rules.getDecision(handle);
+      const auto& considerations = decision.getConsiderations();
+      for (size_t i = 0; i < considerations.size(); ++i) {
+        std::string key = decision.getName() + "/" + considerations[i].getDescription();
+        const unsigned int n = ++seen[key];
+        if (n > 1) {
+          key += "#" + std::to_string(n);
+        }
+        f(decision, i, key);
+      }
+    }
+  }
+
+  template<class T>
+  void put(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template<class T>
+  bool get(std::istream& in, T& value) {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+  }
+}
+
+/** Records the value of every UtilityFunction, tick by tick, to a file.
+ *
+ * Attach it with DecisionEngine::setInputRecorder.  It then wraps the
+ * UtilityFunction of every Consideration, so that the raw value it returns
+ * is kept, and the engine writes the values that changed and the raised
+ * Events at the end of every getBestDecision.  Replay the file with
+ * InputReplay to run the same, or a changed, rule set on the recorded
+ * inputs, without the state that the UtilityFunctions read.
+ *
+ * Only values that were actually read are recorded, so a Decision that was
+ * pruned in a tick gets the previous value of its inputs in a replay.
+ * Decisions with a scorer, see StaticConsiderations, are scored through
+ * their Considerations while they are recorded, and get their scorer back
+ * from detach.
+ */
+class InputRecorder {
+  public:
+    /** Create or truncate the file at path.
+     *
+     * Throws std::runtime_error when the file cannot be created.
+     */
+    explicit InputRecorder(const std::string& path)
+      : out_(path, std::ios::binary | std::ios::trunc),
+      values_(std::make_shared<std::deque<float>>())
+    {
+      if (!out_) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Cannot open input tape " + path));
+      }
+      tape::put(out_, tape::MAGIC);
+      tape::put(out_, tape::VERSION);
+    }
+
+    InputRecorder(const InputRecorder&) = delete;
+    InputRecorder& operator=(const InputRecorder&) = delete;
+
+    /** Wrap the UtilityFunctions of rules that are not wrapped yet. */
+    template<class Rules>
+    void attach(Rules& rules) {
+      tape::forEachInput(rules, [this](Decision& decision, size_t i, const std::string& key) {
+          const UtilityFunction& function = decision.getConsiderations()[i].getUtilityFunction();
+          if (function.target<Recorded>()) {
+            return;
+          }
+          // setUtilityFunction drops the scorer; the first one keeps it.
+          const Scorer scorer = i == 0 ? decision.getScorer() : Scorer();
+          decision.setUtilityFunction(i, Recorded{function, values_, id(key), scorer});
+        });
+    }
+
+    /** Restore the UtilityFunctions that attach wrapped, and the scorers. */
+    template<class Rules>
+    static void detach(Rules& rules) {
+      Scorer scorer;
+      tape::forEachInput(rules, [&scorer](Decision& decision, size_t i, const std::string&) {
+          const Recorded* recorded =
+            decision.getConsiderations()[i].getUtilityFunction().target<Recorded>();
+          if (i == 0) {
+            scorer = recorded ? recorded->scorer : Scorer();
+          }
+          if (recorded) {
+            decision.setUtilityFunction(i, UtilityFunction(recorded->function));
+          }
+          if (i + 1 == decision.getConsiderations().size() && scorer) {
+            decision.setScorer(scorer);
+          }
+        });
+    }
+
+    /** Write the raised Events and the changed values of this tick. */
+    template<class E>
+    void endTick(const EventSet<E>& events) {
+      events_.clear();
+      events.forEach([this](E e) { events_.push_back(static_cast<uint32_t>(e)); });
+      if (events_ != previous_events_) {
+        tape::put(out_, uint8_t(tape::EVENTS));
+        tape::put(out_, static_cast<uint32_t>(events_.size()));
+        for (uint32_t e : events_) {
+          tape::put(out_, e);
+        }
+        previous_events_.swap(events_);
+      }
+      changes_.clear();
+      for (uint32_t i = 0; i < written_.size(); ++i) {
+        uint32_t bits;
+        std::memcpy(&bits, &(*values_)[i], sizeof(bits));
+        if (bits != written_[i]) {
+          written_[i] = bits;
+          changes_.emplace_back(i, (*values_)[i]);
+        }
+      }
+      tape::put(out_, uint8_t(tape::TICK));
+      tape::put(out_, static_cast<uint32_t>(changes_.size()));
+      for (const auto& change : changes_) {
+        tape::put(out_, change.first);
+        tape::put(out_, change.second);
+      }
+      ++ticks_;
+    }
+
+    unsigned long getTicks() const { return ticks_; }
+
+    /** Number of distinct inputs seen so far. */
+    size_t size() const { return written_.size(); }
+
+    /** Write buffered records to the file. */
+    void flush() { out_.flush(); }
+
+  private:
+    /** A UtilityFunction that keeps the last value it returned. */
+    struct Recorded {
+      UtilityFunction function;
+      std::shared_ptr<std::deque<float>> values;
+      uint32_t id;
+      /** The scorer of the Decision, kept by its first Consideration. */
+      Scorer scorer;
+
+      float operator()() const {
+        const float value = function();
+        (*values)[id] = value;
+        return value;
+      }
+    };
+
+    std::ofstream out_;
+    std::map<std::string, uint32_t> ids_;
+    /** Last value read from each input.  A deque, so that adding an input
+     *  does not move the values of the others. */
+    std::shared_ptr<std::deque<float>> values_;
+    /** Bits of the last value written for each input. */
+    std::vector<uint32_t> written_;
+    std::vector<uint32_t> events_;
+    std::vector<uint32_t> previous_events_;
+    std::vector<std::pair<uint32_t, float>> changes_;
+    unsigned long ticks_ = 0;
+
+    /** The id of a key, which is written to the file when it is new. */
+    uint32_t id(const std::string& key) {
+      auto it = ids_.find(key);
+      if (it != ids_.end()) {
+        return it->second;
+      }
+      const uint32_t id = static_cast<uint32_t>(ids_.size());
+      ids_.emplace(key, id);
+      values_->push_back(0.f);
+      written_.push_back(0);
+      changes_.reserve(written_.size());
+      tape::put(out_, uint8_t(tape::KEY));
+      tape::put(out_, id);
+      tape::put(out_, static_cast<uint32_t>(key.size()));
+      out_.write(key.data(), static_cast<std::streamsize>(key.size()));
+      return id;
+    }
+};
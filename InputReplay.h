@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DecisionEngine.h"
+#include "Exceptions.h"
+#include "InputRecorder.h"
+
+/** Plays back a file written by InputRecorder.
+ *
+ * attach replaces the UtilityFunction of every Consideration of an engine
+ * with one that returns the recorded value, matched on the key of the
+ * Consideration (see tape::forEachInput).  Every next() then sets the
+ * raised Events and the values of one recorded tick, so that the following
+ * getBestDecision scores the Decisions as in the recording, but without
+ * calling the original UtilityFunctions:
+ *
+ *     InputReplay replay("match.tape");
+ *     replay.attach(engine);
+ *     while (replay.next(engine)) {
+ *       engine.getBestDecision();
+ *     }
+ *
+ * The rule set may differ from the recorded one.  Considerations that were
+ * not recorded read 0, see getMissing.  Attach again after the rules
+ * changed, for example after DecisionEngine::adoptRules.  attach changes
+ * the Decisions of the engine in place, so call it between ticks, on the
+ * thread that ticks the engine, see DecisionEngine::getMutableRuleSet.
+ */
+class InputReplay {
+  public:
+    /** Open the file at path.
+     *
+     * Throws std::runtime_error when it cannot be opened or is not an input
+     * tape.
+     */
+    explicit InputReplay(const std::string& path)
+      : in_(path, std::ios::binary),
+      values_(std::make_shared<std::vector<float>>())
+    {
+      uint32_t magic = 0;
+      uint32_t version = 0;
+      if (!tape::get(in_, magic) || magic != tape::MAGIC) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Not an input tape: " + path));
+      }
+      if (!tape::get(in_, version) || version != tape::VERSION) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Unsupported input tape version: " + path));
+      }
+    }
+
+    InputReplay(const InputReplay&) = delete;
+    InputReplay& operator=(const InputReplay&) = delete;
+
+    /** Let the Considerations of engine read the recorded values. */
+    void attach(DecisionEngine& engine) {
+      attached_.clear();
+      tape::forEachInput(engine.getMutableRuleSet(),
+          [this](Decision& decision, size_t i, const std::string& key) {
+            attached_.push_back(slot(key));
+            decision.setUtilityFunction(i, Replayed{values_, attached_.back()});
+          });
+    }
+
+    /** Load the next tick into engine.
+     *
+     * Returns false at the end of the file, or at a tick that was not
+     * written completely.  Throws std::runtime_error if the file is
+     * corrupt.
+     */
+    bool next(DecisionEngine& engine) {
+      uint8_t type;
+      while (tape::get(in_, type)) {
+        uint32_t count;
+        if (!tape::get(in_, count)) {
+          return false;
+        }
+        switch (type) {
+          case tape::KEY:
+            if (!readKey(count)) {
+              return false;
+            }
+            break;
+          case tape::EVENTS:
+            if (!readEvents(count)) {
+              return false;
+            }
+            engine.clearActive();
+            for (uint32_t e : events_) {
+              engine.raiseEvent(static_cast<Event>(e));
+            }
+            break;
+          case tape::TICK:
+            if (!readTick(count)) {
+              return false;
+            }
+            ++ticks_;
+            return true;
+          default:
+            BEHAVIOR_ENGINE_THROW(std::runtime_error("Corrupt input tape"));
+        }
+      }
+      return false;
+    }
+
+    /** Number of ticks loaded so far. */
+    unsigned long getTicks() const { return ticks_; }
+
+    /** Number of Considerations of the last attach that the file has not
+     *  recorded so far. */
+    size_t getMissing() const {
+      size_t missing = 0;
+      for (size_t slot : attached_) {
+        if (!recorded_[slot]) {
+          ++missing;
+        }
+      }
+      return missing;
+    }
+
+  private:
+    /** A UtilityFunction that returns a recorded value. */
+    struct Replayed {
+      std::shared_ptr<const std::vector<float>> values;
+      size_t slot;
+
+      float operator()() const { return (*values)[slot]; }
+    };
+
+    std::ifstream in_;
+    /** The slot in values_ of every key, of the rules or of the file. */
+    std::map<std::string, size_t> slots_;
+    std::shared_ptr<std::vector<float>> values_;
+    /** Whether the file has a key for each slot. */
+    std::vector<bool> recorded_;
+    /** The slots of the Considerations of the last attach. */
+    std::vector<size_t> attached_;
+    /** The slot of every id in the file. */
+    std::vector<size_t> ids_;
+    std::vector<uint32_t> events_;
+    std::vector<std::pair<uint32_t, float>> changes_;
+    unsigned long ticks_ = 0;
+
+    size_t slot(const std::string& key) {
+      auto it = slots_.find(key);
+      if (it != slots_.end()) {
+        return it->second;
+      }
+      slots_.emplace(key, values_->size());
+      values_->push_back(0.f);
+      recorded_.push_back(false);
+      return values_->size() - 1;
+    }
+
+    bool readKey(uint32_t id) {
+      uint32_t length;
+      if (!tape::get(in_, length)) {
+        return false;
+      }
+      std::string key(length, '\0');
+      if (!in_.read(&key[0], static_cast<std::streamsize>(length))) {
+        return false;
+      }
+      if (ids_.size() <= id) {
+        ids_.resize(id + 1, 0);
+      }
+      ids_[id] = slot(key);
+      recorded_[ids_[id]] = true;
+      return true;
+    }
+
+    bool readEvents(uint32_t count) {
+      events_.resize(count);
+      for (uint32_t& e : events_) {
+        if (!tape::get(in_, e)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /** Read all values of a tick before applying them, so that a partly
+     *  written tick is left out entirely. */
+    bool readTick(uint32_t count) {
+      changes_.resize(count);
+      for (auto& change : changes_) {
+        if (!tape::get(in_, change.first) || !tape::get(in_, change.second)) {
+          return false;
+        }
+        if (change.first >= ids_.size()) {
+          BEHAVIOR_ENGINE_THROW(std::runtime_error("Corrupt input tape"));
+        }
+      }
+      for (const auto& change : changes_) {
+        (*values_)[ids_[change.first]] = change.second;
+      }
+      return true;
+    }
+};
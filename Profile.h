@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/** Set to 1 to count, for every Decision and Consideration, how often it
+ *  is computed, how long that takes and how often it ends the scoring of
+ *  its Decision early.  See ProfileCounters and
+ *  DecisionEngine::collectProfile. */
+#ifndef BEHAVIOR_ENGINE_PROFILE
+#define BEHAVIOR_ENGINE_PROFILE 0
+#endif
+
+/** Counters of a Decision or Consideration.
+ *
+ * They stay zero unless BEHAVIOR_ENGINE_PROFILE is set.  Assign
+ * ProfileCounters() to reset them.
+ */
+struct ProfileCounters {
+  /** Number of times its score was computed. */
+  unsigned long evaluations = 0;
+  /** For a Decision, the number of times its scoring stopped before all
+   *  Considerations were computed.  For a Consideration, the number of
+   *  times the scoring of its Decision stopped right after it. */
+  unsigned long early_exits = 0;
+  /** For a Decision, the number of times getBestDecision skipped it
+   *  because its upper bound could not beat the best score. */
+  unsigned long skips = 0;
+  /** Total time spent computing its score. */
+  std::chrono::nanoseconds time = std::chrono::nanoseconds::zero();
+};
+
+/** The counters of a Consideration, with its description. */
+struct ConsiderationProfile {
+  std::string description;
+  ProfileCounters counters;
+};
+
+/** The counters of a Decision and its Considerations, with its name. */
+struct DecisionProfile {
+  std::string name;
+  ProfileCounters counters;
+  std::vector<ConsiderationProfile> considerations;
+};
+
+#if BEHAVIOR_ENGINE_PROFILE
+/** Counts an evaluation and its time when it goes out of scope. */
+class ProfileTimer {
+  public:
+    explicit ProfileTimer(ProfileCounters& counters)
+      : counters_(counters),
+      start_(std::chrono::steady_clock::now())
+    {}
+
+    ~ProfileTimer() {
+      counters_.time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start_);
+      ++counters_.evaluations;
+    }
+
+  private:
+    ProfileCounters& counters_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#define BEHAVIOR_ENGINE_PROFILE_SCOPE(COUNTERS) ProfileTimer profile_timer(COUNTERS)
+#define BEHAVIOR_ENGINE_PROFILE_SKIP(COUNTERS) (++(COUNTERS).skips)
+#else
+#define BEHAVIOR_ENGINE_PROFILE_SCOPE(COUNTERS) ((void) 0)
+#define BEHAVIOR_ENGINE_PROFILE_SKIP(COUNTERS) ((void) 0)
+#endif
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DecisionEngine.h"
+#include "Exceptions.h"
+#include "RuleSetBuilder.h"
+
+/** Layout of a rule file, as exported by the behavior designer.
+ *
+ * A Header is followed by tables of Decisions, Considerations, Points,
+ * event names and strings, at the offsets in the Header.  Decisions refer
+ * to a range of Considerations and of event names, Considerations to a
+ * range of Points.  Strings are offsets into the string table, which holds
+ * NUL-terminated strings.  Everything is 4-byte aligned and little endian.
+ */
+namespace rulefile {
+  constexpr uint32_t MAGIC = 0x53524542;  // "BERS"
+  constexpr uint32_t VERSION = 1;
+
+  enum SplineKind : uint32_t {
+    LINEAR = 0,
+    STEP_BEFORE = 1,
+    STEP_AFTER = 2,
+    MONOTONE = 3,
+  };
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t decision_count;
+    uint32_t decisions_offset;
+    uint32_t consideration_count;
+    uint32_t considerations_offset;
+    uint32_t point_count;
+    uint32_t points_offset;
+    uint32_t event_count;
+    uint32_t events_offset;
+    uint32_t strings_size;
+    uint32_t strings_offset;
+  };
+
+  struct Decision {
+    uint32_t name;
+    uint32_t description;
+    /** Name of a bound Action. */
+    uint32_t action;
+    /** A UtilityScore. */
+    int32_t utility;
+    uint32_t first_event;
+    uint32_t event_count;
+    uint32_t first_consideration;
+    uint32_t consideration_count;
+  };
+
+  struct Consideration {
+    uint32_t description;
+    /** Name of an InputChannel of the engine. */
+    uint32_t input;
+    /** Finite, with min < max. */
+    float min;
+    float max;
+    /** A SplineKind. */
+    uint32_t spline;
+    uint32_t first_point;
+    /** At least 1.  A single point makes a constant curve. */
+    uint32_t point_count;
+    uint32_t reserved;
+  };
+
+  /** Finite.  The points of a Consideration have strictly increasing x. */
+  struct Point {
+    float x;
+    float y;
+  };
+
+  /** The name of an Event, as an offset into the string table. */
+  using EventName = uint32_t;
+
+  static_assert(sizeof(Header) == 48, "Header layout");
+  static_assert(sizeof(Decision) == 32, "Decision layout");
+  static_assert(sizeof(Consideration) == 32, "Consideration layout");
+  static_assert(sizeof(Point) == 8, "Point layout");
+}
+
+/** What the names in a rule file refer to. */
+struct RuleBindings {
+  std::map<std::string, Event> events_by_name;
+  std::map<std::string, Action> actions_by_name;
+};
+
+/** A memory-mapped rule file.
+ *
+ * Behavior designed in the designer can be exported as a rule file instead
+ * of C++ code, so it can be changed without recompiling.  Considerations
+ * read the InputChannels of the engine by name, see DecisionEngine::addInput,
+ * and Events and Actions are looked up by name in a RuleBindings:
+ *
+ *     RuleFile file("striker.rules");
+ *     engine.publish(file.load(engine, bindings));
+ *
+ * The file is checked when it is opened.  load copies the rules into a
+ * RuleSetBuilder that is sized for the file, so the RuleSet does not refer
+ * to the file, and the RuleFile can be closed once it is loaded.  Only
+ * the checks read the file in place: the points of a Curve pass through a
+ * reused vector and a Curve before they reach the Arena of the builder.
+ */
+class RuleFile {
+  public:
+    /** Map the file at path, and check its layout.
+     *
+     * Throws std::runtime_error when the file cannot be read, or is not a
+     * valid rule file of this version.
+     */
+    explicit RuleFile(const std::string& path) {
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Cannot open rule file " + path));
+      }
+      struct stat status;
+      if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Cannot read rule file " + path));
+      }
+      size_ = static_cast<size_t>(status.st_size);
+      void* memory = size_ > 0 ? ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+      ::close(fd);
+      if (memory == MAP_FAILED) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Cannot map rule file " + path));
+      }
+      memory_ = static_cast<const char*>(memory);
+      if (!valid()) {
+        ::munmap(const_cast<char*>(memory_), size_);
+        BEHAVIOR_ENGINE_THROW(std::runtime_error("Not a valid rule file: " + path));
+      }
+    }
+
+    RuleFile(const RuleFile&) = delete;
+    RuleFile& operator=(const RuleFile&) = delete;
+
+    ~RuleFile() {
+      ::munmap(const_cast<char*>(memory_), size_);
+    }
+
+    size_t getDecisionCount() const { return header().decision_count; }
+
+    /** Build a RuleSet of all Decisions in the file.
+     *
+     * Throws std::runtime_error if an input channel of engine, an Event or
+     * an Action that the file names does not exist.
+     */
+    std::unique_ptr<RuleSet> load(const DecisionEngine& engine, const RuleBindings& bindings) const {
+      RuleSetBuilder builder(header().decision_count, header().consideration_count,
+          header().point_count);
+      const rulefile::Decision* decisions = table<rulefile::Decision>(header().decisions_offset);
+      const rulefile::Consideration* all = table<rulefile::Consideration>(header().considerations_offset);
+      const rulefile::Point* points = table<rulefile::Point>(header().points_offset);
+      const rulefile::EventName* event_names = table<rulefile::EventName>(header().events_offset);
+      std::vector<Spline::P2> p;
+      for (uint32_t d = 0; d < header().decision_count; ++d) {
+        const rulefile::Decision& decision = decisions[d];
+        events e;
+        e.reserve(decision.event_count);
+        for (uint32_t i = 0; i < decision.event_count; ++i) {
+          e.push_back(find(bindings.events_by_name, event_names[decision.first_event + i], "Event"));
+        }
+        considerations c;
+        c.reserve(decision.consideration_count);
+        for (uint32_t i = 0; i < decision.consideration_count; ++i) {
+          const rulefile::Consideration& consideration = all[decision.first_consideration + i];
+          const Input input = engine.getInput(text(consideration.input));
+          if (!input) {
+            BEHAVIOR_ENGINE_THROW(std::runtime_error(std::string("Unknown input channel ") + text(consideration.input)));
+          }
+          const rulefile::Point* first = points + consideration.first_point;
+          p.clear();
+          for (uint32_t j = 0; j < consideration.point_count; ++j) {
+            p.push_back({first[j].x, first[j].y});
+          }
+          c.emplace_back(text(consideration.description), input,
+              spline(static_cast<rulefile::SplineKind>(consideration.spline), p),
+              range(consideration.min, consideration.max));
+        }
+        builder.addDecision(name(text(decision.name)),
+            description(text(decision.description)),
+            static_cast<UtilityScore>(decision.utility),
+            e,
+            c,
+            find(bindings.actions_by_name, decision.action, "Action"));
+      }
+      return builder.build();
+    }
+
+  private:
+    const char* memory_ = nullptr;
+    size_t size_ = 0;
+
+    const rulefile::Header& header() const {
+      return *reinterpret_cast<const rulefile::Header*>(memory_);
+    }
+
+    template<class T>
+    const T* table(uint32_t offset) const {
+      return reinterpret_cast<const T*>(memory_ + offset);
+    }
+
+    const char* text(uint32_t offset) const {
+      return memory_ + header().strings_offset + offset;
+    }
+
+    template<class T>
+    const T& find(const std::map<std::string, T>& bound, uint32_t offset, const char* kind) const {
+      auto it = bound.find(text(offset));
+      if (it == bound.end()) {
+        BEHAVIOR_ENGINE_THROW(std::runtime_error(std::string("Unknown ") + kind + " " + text(offset)));
+      }
+      return it->second;
+    }
+
+    static Spline::SplineFunction spline(rulefile::SplineKind kind, const std::vector<Spline::P2>& points) {
+      switch (kind) {
+        case rulefile::STEP_BEFORE: return Spline::StepBefore(points);
+        case rulefile::STEP_AFTER: return Spline::StepAfter(points);
+        case rulefile::MONOTONE: return Spline::Monotone(points);
+        case rulefile::LINEAR:
+          break;
+      }
+      return Spline::Linear(points);
+    }
+
+    /** Whether count points from first make a curve: finite, and sorted on
+     *  x without duplicates, so that no segment has zero width. */
+    static bool validCurve(const rulefile::Point* first, uint32_t count) {
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!std::isfinite(first[i].x) || !std::isfinite(first[i].y)
+            || (i > 0 && !(first[i - 1].x < first[i].x))) {
+          return false;
+        }
+      }
+      return count > 0;
+    }
+
+    /** Whether count items of size bytes at offset fit in the file. */
+    bool fits(uint32_t offset, uint32_t count, size_t size) const {
+      return offset % 4 == 0 && offset <= size_ && count <= (size_ - offset) / size;
+    }
+
+    /** Whether [first, first + count) lies within a table of size entries. */
+    static bool within(uint32_t first, uint32_t count, uint32_t size) {
+      return first <= size && count <= size - first;
+    }
+
+    bool validString(uint32_t offset) const {
+      return offset < header().strings_size;
+    }
+
+    bool valid() const {
+      if (size_ < sizeof(rulefile::Header)) {
+        return false;
+      }
+      const rulefile::Header& h = header();
+      if (h.magic != rulefile::MAGIC || h.version != rulefile::VERSION
+          || !fits(h.decisions_offset, h.decision_count, sizeof(rulefile::Decision))
+          || !fits(h.considerations_offset, h.consideration_count, sizeof(rulefile::Consideration))
+          || !fits(h.points_offset, h.point_count, sizeof(rulefile::Point))
+          || !fits(h.events_offset, h.event_count, sizeof(rulefile::EventName))
+          || !fits(h.strings_offset, h.strings_size, 1)
+          // Every string ends within the table.
+          || h.strings_size == 0 || memory_[h.strings_offset + h.strings_size - 1] != '\0') {
+        return false;
+      }
+      const rulefile::Decision* decisions = table<rulefile::Decision>(h.decisions_offset);
+      for (uint32_t d = 0; d < h.decision_count; ++d) {
+        const rulefile::Decision& decision = decisions[d];
+        if (!validString(decision.name) || !validString(decision.description)
+            || !validString(decision.action)
+            || decision.utility < 0 || decision.utility > int32_t(UtilityScore::MostUseful)
+            || !within(decision.first_event, decision.event_count, h.event_count)
+            || !within(decision.first_consideration, decision.consideration_count, h.consideration_count)) {
+          return false;
+        }
+      }
+      const rulefile::Consideration* all = table<rulefile::Consideration>(h.considerations_offset);
+      const rulefile::Point* points = table<rulefile::Point>(h.points_offset);
+      for (uint32_t c = 0; c < h.consideration_count; ++c) {
+        const rulefile::Consideration& consideration = all[c];
+        // The range is divided by max - min.
+        if (!validString(consideration.description) || !validString(consideration.input)
+            || !std::isfinite(consideration.min) || !std::isfinite(consideration.max)
+            || !(consideration.min < consideration.max)
+            || consideration.spline > rulefile::MONOTONE
+            || !within(consideration.first_point, consideration.point_count, h.point_count)
+            || !validCurve(points + consideration.first_point, consideration.point_count)) {
+          return false;
+        }
+      }
+      const rulefile::EventName* event_names = table<rulefile::EventName>(h.events_offset);
+      for (uint32_t e = 0; e < h.event_count; ++e) {
+        if (!validString(event_names[e])) {
+          return false;
+        }
+      }
+      return true;
+    }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "Arena.h"
+#include "DecisionEngine.h"
+
+/** Builds a RuleSet whose Decisions share a few blocks of memory.
+ *
+ * RuleSet::addDecision allocates every Decision, its Considerations and
+ * each of its Curves on its own, and every name and description is a string
+ * of its own.  A RuleSetBuilder puts the Decisions with their Considerations
+ * in one Arena, and the points of all Curves with all names and
+ * descriptions in a second one.  Names and descriptions are interned: each
+ * distinct string is stored once.  When the sizes are given up front, the
+ * rules take a few allocations however large they are, and their memory is
+ * known before they are loaded:
+ *
+ *     RuleSetBuilder builder(decisions, considerations, points);
+ *     builder.addDecision(name("Kick"), description("..."),
+ *         UtilityScore::Useful, events {...}, considerations {...}, ...);
+ *     engine.publish(builder.build());
+ *
+ * The second Arena only holds data, so Decisions and Considerations that
+ * are copied out of the RuleSet keep it alive without keeping the
+ * Decisions alive.  Strings longer than the small-string buffer of
+ * std::string keep their characters on the heap, once per distinct string.
+ * UtilityFunctions, Actions and splines that are not a Curve are moved in
+ * as they are.
+ */
+class RuleSetBuilder {
+  public:
+    /** Size the Arenas for the given numbers of Decisions, Considerations
+     *  and Curve points.  They grow when more are added. */
+    explicit RuleSetBuilder(size_t decision_count = 0,
+        size_t consideration_count = 0,
+        size_t point_count = 0)
+    {
+      reset(decision_count, consideration_count, point_count);
+    }
+
+    RuleSetBuilder(const RuleSetBuilder&) = delete;
+    RuleSetBuilder& operator=(const RuleSetBuilder&) = delete;
+
+    /** Add a new Decision, like RuleSet::addDecision.  Returns its handle. */
+    DecisionHandle addDecision(const name& n,
+        const description& d,
+        UtilityScore u,
+        const events& e,
+        considerations c,
+        Action a)
+    {
+      ConsiderationList list{ArenaAllocator<Consideration>(decisions_.get())};
+      list.reserve(c.size());
+      for (Consideration& consideration : c) {
+        consideration.setDescription(intern(consideration.getDescription()));
+        if (const Spline::Curve* curve = Spline::curveOf(consideration.getSpline())) {
+          const Spline::Curve* copy = data_->create<Spline::Curve>(*curve,
+              Spline::Curve::Allocator(data_.get()));
+          consideration.setSpline(std::cref(*copy), data_);
+        }
+        list.push_back(std::move(consideration));
+      }
+      Decision* decision = decisions_->create<Decision>(intern(n), intern(d), u,
+          std::move(list), std::move(a));
+      return rules_->addDecision(std::shared_ptr<Decision>(decisions_, decision), e);
+    }
+
+    /** Add a new Decision whose Considerations are statically dispatched,
+     *  see RuleSet::addDecision. */
+    template<class... Cs>
+    DecisionHandle addDecision(const name& n,
+        const description& d,
+        UtilityScore u,
+        const events& e,
+        const StaticConsiderations<Cs...>& c,
+        Action a)
+    {
+      const DecisionHandle handle = addDecision(n, d, u, e, considerations(c), std::move(a));
+      rules_->getDecision(handle)->setScorer([c](const Decision& decision, float threshold) {
+          return c.computeScore(decision, threshold);
+        });
+      return handle;
+    }
+
+    /** The RuleSet built so far.  The builder starts over, empty. */
+    std::unique_ptr<RuleSet> build() {
+      std::unique_ptr<RuleSet> rules = std::move(rules_);
+      reset(0, 0, 0);
+      return rules;
+    }
+
+    /** Bytes in both Arenas together. */
+    size_t getCapacity() const {
+      return decisions_->getCapacity() + data_->getCapacity();
+    }
+
+    /** Number of blocks that both Arenas allocated together. */
+    size_t getBlockCount() const {
+      return decisions_->getBlockCount() + data_->getBlockCount();
+    }
+
+  private:
+    /** Decisions, and their Considerations and upper bounds. */
+    std::shared_ptr<Arena> decisions_;
+    /** Curves and strings. */
+    std::shared_ptr<Arena> data_;
+    std::unique_ptr<RuleSet> rules_;
+    /** Every string in data_, by its contents. */
+    std::unordered_map<std::string, Text> strings_;
+
+    void reset(size_t decision_count, size_t consideration_count, size_t point_count) {
+      decisions_ = std::make_shared<Arena>(
+          decision_count * (Arena::objectSpace<Decision>()
+            + Arena::arraySpace<Consideration>(1) - sizeof(Consideration)
+            + Arena::arraySpace<float>(1))
+          + consideration_count * (sizeof(Consideration) + sizeof(float)));
+      const size_t string_count = 2 * decision_count + consideration_count;
+      // A Curve has up to five arrays with a float per point.
+      data_ = std::make_shared<Arena>(
+          string_count * Arena::objectSpace<std::string>()
+          + consideration_count * (Arena::objectSpace<Spline::Curve>()
+            + 5 * (Arena::arraySpace<float>(1) - sizeof(float)))
+          + point_count * 5 * sizeof(float));
+      rules_.reset(new RuleSet());
+      rules_->reserve(decision_count);
+      strings_.clear();
+    }
+
+    Text intern(const std::string& s) {
+      auto it = strings_.find(s);
+      if (it == strings_.end()) {
+        const std::string* text = data_->create<std::string>(s);
+        it = strings_.emplace(s, Text(std::shared_ptr<const std::string>(data_, text))).first;
+      }
+      return it->second;
+    }
+};
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <functional>
+#include "Arena.h"
+#include "SplineSimd.h"
 
 namespace Spline {
   struct P2
@@ -12,136 +18,440 @@ namespace Spline {
 
   using SplineFunction = std::function<float(float)>;
 
-  // pass by value so compiler can optimize this properly
-  inline SplineFunction Linear(std::vector<P2> points) {
-    return [points](float x) {
-      if (x <= points.front().x) { return points.front().y; }
-      if (x >= points.back().x) { return points.back().y; }
+  /** A spline through a fixed list of control points.
+   *
+   * A Curve is what Linear(), StepBefore(), StepAfter() and Monotone()
+   * return.  It keeps its control points, so besides the scalar operator()
+   * it can evaluate a whole array of inputs at once with the SIMD kernels of
+   * SplineSimd.h.
+   *
+   * Its points can be kept in an Arena, see RuleSetBuilder.  Copies keep
+   * theirs on the heap.
+   */
+  class Curve {
+    public:
+      enum class Kind { Linear, StepBefore, StepAfter, Monotone };
+      using Allocator = ArenaAllocator<float>;
 
-      size_t count = points.size() - 1;
-      for (size_t i = 0; i < count; ++i)
+      /** A curve through points, sorted on x.  There should be at least one.
+       *
+       * With a single point the curve is constant, and a Monotone one is
+       * evaluated as Linear: its coefficients need two points.
+       */
+      // pass by value so compiler can optimize this properly
+      Curve(Kind kind, std::vector<P2> points, const Allocator& allocator = Allocator())
+        : kind_(kind),
+        xs_(allocator),
+        ys_(allocator),
+        coefficients1_(allocator),
+        coefficients2_(allocator),
+        coefficients3_(allocator)
       {
-        P2 a = points[i];
-        P2 b = points[i + 1];
+        assert(!points.empty());
+        if (points.size() < 2 && kind_ == Kind::Monotone) {
+          kind_ = Kind::Linear;
+        }
+        xs_.reserve(points.size());
+        ys_.reserve(points.size());
+        for (const P2& point : points) {
+          xs_.push_back(point.x);
+          ys_.push_back(point.y);
+        }
+        if (kind_ == Kind::Monotone) {
+          computeMonotoneCoefficients();
+        }
+      }
+
+      /** Copy other, with the points taken from allocator. */
+      Curve(const Curve& other, const Allocator& allocator)
+        : kind_(other.kind_),
+        xs_(other.xs_, allocator),
+        ys_(other.ys_, allocator),
+        coefficients1_(other.coefficients1_, allocator),
+        coefficients2_(other.coefficients2_, allocator),
+        coefficients3_(other.coefficients3_, allocator)
+      {}
 
-        if (x >= a.x && x <= b.x)
+      Curve(const Curve& other) = default;
+      Curve(Curve&& other) = default;
+      Curve& operator=(const Curve& other) = default;
+      Curve& operator=(Curve&& other) = default;
+
+      float operator()(float x) const {
+        if (x <= xs_.front()) { return ys_.front(); }
+        if (x >= xs_.back()) { return ys_.back(); }
+
+        size_t count = xs_.size() - 1;
+        if (kind_ == Kind::Monotone) {
+          return monotone(x, count);
+        }
+        for (size_t i = 0; i < count; ++i)
         {
-          float interpolation = (x - a.x) / (b.x - a.x);
-          return (1 - interpolation) * a.y + interpolation * b.y;
+          if (x >= xs_[i] && x <= xs_[i + 1])
+          {
+            switch (kind_) {
+              case Kind::StepBefore: return ys_[i + 1];
+              case Kind::StepAfter: return ys_[i];
+              case Kind::Linear:
+              case Kind::Monotone:
+                break;
+            }
+            float interpolation = (x - xs_[i]) / (xs_[i + 1] - xs_[i]);
+            return (1 - interpolation) * ys_[i] + interpolation * ys_[i + 1];
+          }
         }
+
+        return ys_.back();
       }
 
-      return points.back().y;
-    };
-  }
+      /** Evaluate the curve for size inputs, writing size outputs.
+       *
+       * out[i] is exactly what operator()(in[i]) returns.
+       */
+      void evaluate(const float* in, float* out, size_t size) const {
+        const size_t n = xs_.size();
+        switch (kind_) {
+          case Kind::Linear:
+            simd::evaluate<simd::Segment::Linear>(xs_.data(), ys_.data(), n, in, out, size);
+            break;
+          case Kind::StepBefore:
+            simd::evaluate<simd::Segment::StepBefore>(xs_.data(), ys_.data(), n, in, out, size);
+            break;
+          case Kind::StepAfter:
+            simd::evaluate<simd::Segment::StepAfter>(xs_.data(), ys_.data(), n, in, out, size);
+            break;
+          case Kind::Monotone:
+            simd::evaluate(xs_.data(), ys_.data(), n, coefficients1_.data(),
+                coefficients2_.data(), coefficients3_.data(), in, out, size);
+            break;
+        }
+      }
 
-  inline SplineFunction StepBefore(std::vector<P2> points) {
-    return [points](float x) {
-      if (x <= points.front().x) { return points.front().y; }
-      if (x >= points.back().x) { return points.back().y; }
+      /** The highest value this Curve returns for any input.
+       *
+       * The Curve is constant outside its first and last control point, so
+       * this also bounds inputs that were scaled outside [0, 1].
+       */
+      float getMaximum() const {
+        float maximum = ys_.front();
+        for (float y : ys_) {
+          maximum = std::max(maximum, y);
+        }
+        if (kind_ != Kind::Monotone) {
+          // Linear interpolation and steps never leave the range of the ys.
+          return maximum;
+        }
+        // A cubic segment may overshoot its end points: also check where
+        // its derivative c1 + 2 c2 d + 3 c3 d^2 is zero.
+        for (size_t i = 0; i + 1 < xs_.size(); ++i) {
+          const double a = 3.0 * coefficients3_[i];
+          const double b = 2.0 * coefficients2_[i];
+          const double c = coefficients1_[i];
+          double roots[2];
+          size_t count = 0;
+          if (std::fabs(a) < 1e-12) {
+            if (std::fabs(b) >= 1e-12) {
+              roots[count++] = -c / b;
+            }
+          } else {
+            const double discriminant = b * b - 4.0 * a * c;
+            if (discriminant >= 0.0) {
+              roots[count++] = (-b + std::sqrt(discriminant)) / (2.0 * a);
+              roots[count++] = (-b - std::sqrt(discriminant)) / (2.0 * a);
+            }
+          }
+          for (size_t r = 0; r < count; ++r) {
+            const float diff = static_cast<float>(roots[r]);
+            if (diff > 0.f && diff < xs_[i + 1] - xs_[i]) {
+              const float diffSq = diff * diff;
+              maximum = std::max(maximum, ys_[i] + coefficients1_[i] * diff
+                  + coefficients2_[i] * diffSq + coefficients3_[i] * diff * diffSq);
+            }
+          }
+        }
+        return maximum;
+      }
 
-      size_t count = points.size() - 1;
-      for (size_t i = 0; i < count; ++i)
-      {
-        P2 a = points[i];
-        P2 b = points[i + 1];
+      Kind getKind() const { return kind_; }
 
-        if (x >= a.x && x <= b.x) { return b.y; }
+      std::vector<P2> getPoints() const {
+        std::vector<P2> points(xs_.size());
+        for (size_t i = 0; i < points.size(); ++i) {
+          points[i] = {xs_[i], ys_[i]};
+        }
+        return points;
       }
 
-      return points.back().y;
-    };
-  }
+    private:
+      using Floats = std::vector<float, Allocator>;
 
-  inline SplineFunction StepAfter(std::vector<P2> points) {
-    return [points](float x) {
-      if (x <= points.front().x) { return points.front().y; }
-      if (x >= points.back().x) { return points.back().y; }
+      Kind kind_;
+      Floats xs_;
+      Floats ys_;
+      Floats coefficients1_;
+      Floats coefficients2_;
+      Floats coefficients3_;
 
-      size_t count = points.size() - 1;
-      for (size_t i = 0; i < count; ++i)
-      {
-        P2 a = points[i];
-        P2 b = points[i + 1];
+      // Computed where needed rather than kept in temporary arrays, so that
+      // a Curve in an Arena allocates nothing else.
+      float deltaXAt(size_t i) const { return xs_[i + 1] - xs_[i]; }
+      float slopeAt(size_t i) const { return (ys_[i + 1] - ys_[i]) / deltaXAt(i); }
 
-        if (x >= a.x && x <= b.x) { return a.y; }
+      void computeMonotoneCoefficients() {
+        size_t count = xs_.size() - 1;
+        coefficients1_.resize(xs_.size());
+        coefficients2_.resize(count);
+        coefficients3_.resize(count);
+
+        coefficients1_[0] = slopeAt(0);
+        for (size_t i = 0; i < count - 1; ++i)
+        {
+          float slope = slopeAt(i);
+          float slopeNext = slopeAt(i + 1);
+
+          if (slope * slopeNext <= 0)
+          { 
+            coefficients1_[i + 1] = 0; 
+          }
+          else
+          {
+            float dx = deltaXAt(i);
+            float dxNext = deltaXAt(i + 1);
+            float common = dx + dxNext;
+            coefficients1_[i + 1] = 3 * common / ((common + dxNext) / slope + (common + dx) / slopeNext);
+          }
+        }
+        coefficients1_.back() = slopeAt(count - 1);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+          float c1 = coefficients1_[i];
+          float slope = slopeAt(i);
+          float invDx = 1 / deltaXAt(i);
+          float common = c1 + coefficients1_[i + 1] - 2 * slope;
+          coefficients2_[i] = (slope - c1 - common) * invDx;
+          coefficients3_[i] = common * invDx * invDx;
+        }
+      }
+
+      float monotone(float x, size_t count) const {
+        size_t low = 0;
+        size_t mid;
+        size_t high = count - 1;
+
+        while (low <= high)
+        {
+          mid = (low + high) / 2;
+          float xHere = xs_[mid];
+
+          if (xHere < x) { low = mid + 1; }
+          else if (xHere > x) { high = mid - 1; }
+          else { return ys_[mid]; }
+        }
+
+        size_t i = (high > 0) ? high : 0;
+
+        float diff = x - xs_[i];
+        float diffSq = diff * diff;
+        return ys_[i] + coefficients1_[i] * diff + coefficients2_[i] * diffSq + coefficients3_[i] * diff * diffSq;
       }
+  };
 
-      return points[count].y;
-    };
+  // These return the Curve itself, so that a StaticConsideration can call
+  // it directly.  It converts to a SplineFunction where one is needed.
+  // pass by value so compiler can optimize this properly
+  inline Curve Linear(std::vector<P2> points) {
+    return Curve(Curve::Kind::Linear, points);
   }
 
-  inline SplineFunction Monotone(std::vector<P2> points)
-  {
-    size_t count = points.size() - 1;
-    std::vector<float> deltaXs(count);
-    std::vector<float> slopes(count);
-    std::vector<float> coefficients1(points.size()), coefficients2(count), coefficients3(count);
-
-    for (size_t i = 0; i < count; ++i)
-    {
-      P2 a = points[i];
-      P2 b = points[i + 1];
-
-      P2 d = { b.x - a.x, b.y - a.y };
-      deltaXs[i] = d.x;
-      slopes[i] = d.y / d.x;
+  inline Curve StepBefore(std::vector<P2> points) {
+    return Curve(Curve::Kind::StepBefore, points);
+  }
+
+  inline Curve StepAfter(std::vector<P2> points) {
+    return Curve(Curve::Kind::StepAfter, points);
+  }
+
+  inline Curve Monotone(std::vector<P2> points) {
+    return Curve(Curve::Kind::Monotone, points);
+  }
+
+  /** The Curve that spline holds, or refers to with std::cref, or nullptr. */
+  inline const Curve* curveOf(const SplineFunction& spline) {
+    if (const Curve* curve = spline.target<Curve>()) {
+      return curve;
+    }
+    if (const auto* reference = spline.target<std::reference_wrapper<const Curve>>()) {
+      return &reference->get();
     }
+    return nullptr;
+  }
+
+  /** A SplineFunction sampled into a lookup table over [0, 1].
+   *
+   * After scale(), the input of every Consideration lies in [0, 1], so a
+   * table of resolution + 1 samples with linear interpolation between them
+   * evaluates in constant time, however many control points the curve has.
+   * Inputs outside [0, 1] are clamped to the first or last sample.
+   *
+   * The baked curve differs from the source near kinks and steps that fall
+   * between samples.  getMaxError() reports the largest difference found
+   * while probing 16 points per table cell and, for a Curve, every control
+   * point within [0, 1].
+   */
+  class Baked {
+    public:
+      explicit Baked(const SplineFunction& spline, size_t resolution = 256)
+        : resolution_(resolution < 1 ? 1 : resolution),
+        max_error_(0.f)
+      {
+        std::vector<float> table(resolution_ + 1);
+        for (size_t i = 0; i <= resolution_; ++i) {
+          table[i] = spline(static_cast<float>(i) / static_cast<float>(resolution_));
+        }
+        table_ = std::make_shared<const std::vector<float>>(std::move(table));
+
+        const size_t probes = resolution_ * 16;
+        for (size_t i = 0; i <= probes; ++i) {
+          measure(spline, static_cast<float>(i) / static_cast<float>(probes));
+        }
+        if (const Curve* curve = curveOf(spline)) {
+          for (const P2& point : curve->getPoints()) {
+            if (point.x >= 0.f && point.x <= 1.f) {
+              measure(spline, point.x);
+            }
+          }
+        }
+      }
 
-    coefficients1[0] = slopes[0];
-    for (size_t i = 0; i < count - 1; ++i)
-    {
-      float slope = slopes[i];
-      float slopeNext = slopes[i + 1];
+      float operator()(float x) const {
+        const std::vector<float>& table = *table_;
+        if (!(x > 0.f)) { return table.front(); }
+        if (x >= 1.f) { return table.back(); }
+        const float position = x * static_cast<float>(resolution_);
+        size_t i = static_cast<size_t>(position);
+        if (i >= resolution_) { i = resolution_ - 1; }
+        const float interpolation = position - static_cast<float>(i);
+        return table[i] + interpolation * (table[i + 1] - table[i]);
+      }
 
-      if (slope * slopeNext <= 0)
-      { 
-        coefficients1[i + 1] = 0; 
+      void evaluate(const float* in, float* out, size_t size) const {
+        simd::evaluate(table_->data(), resolution_, in, out, size);
       }
-      else
-      {
-        float dx = deltaXs[i];
-        float dxNext = deltaXs[i + 1];
-        float common = dx + dxNext;
-        coefficients1[i + 1] = 3 * common / ((common + dxNext) / slope + (common + dx) / slopeNext);
+
+      /** The highest value in the table, and thus of the baked curve. */
+      float getMaximum() const {
+        return *std::max_element(table_->begin(), table_->end());
       }
-    }
-    coefficients1.back() = slopes.back();
-
-    for (size_t i = 0; i < count; ++i)
-    {
-      float c1 = coefficients1[i];
-      float slope = slopes[i];
-      float invDx = 1 / deltaXs[i];
-      float common = c1 + coefficients1[i + 1] - 2 * slope;
-      coefficients2[i] = (slope - c1 - common) * invDx;
-      coefficients3[i] = common * invDx * invDx;
-    }
 
-    return [=](float x)
-    {
-      if (x <= points.front().x) { return points.front().y; }
-      if (x >= points.back().x) { return points.back().y; }
+      /** Largest difference with the source curve that was found. */
+      float getMaxError() const { return max_error_; }
+      size_t getResolution() const { return resolution_; }
 
-      size_t low = 0;
-      size_t mid;
-      size_t high = count - 1;
+    private:
+      std::shared_ptr<const std::vector<float>> table_;
+      size_t resolution_;
+      float max_error_;
+
+      void measure(const SplineFunction& spline, float x) {
+        const float error = std::fabs(spline(x) - (*this)(x));
+        if (error > max_error_) {
+          max_error_ = error;
+        }
+      }
+  };
 
-      while (low <= high)
+  /** A curve sampled at evenly spaced points over [0, 1], in a table that
+   *  lives elsewhere.
+   *
+   * Evaluates like Baked, but refers to an array instead of building one,
+   * so it costs nothing to construct.  The behavior designer exports curves
+   * as constexpr arrays with a Table for each:
+   *
+   *     static constexpr float kick_near[] = {1.f, 0.98f, ..., 0.f};
+   *     Spline::Table(kick_near)
+   *
+   * The array must outlive the Table.
+   */
+  class Table {
+    public:
+      template<size_t N>
+      constexpr explicit Table(const float (&samples)[N])
+        : samples_(samples),
+        resolution_(N - 1)
       {
-        mid = (low + high) / 2;
-        float xHere = points[mid].x;
+        static_assert(N >= 2, "A Table needs at least two samples");
+      }
+
+      float operator()(float x) const {
+        if (!(x > 0.f)) { return samples_[0]; }
+        if (x >= 1.f) { return samples_[resolution_]; }
+        const float position = x * static_cast<float>(resolution_);
+        size_t i = static_cast<size_t>(position);
+        if (i >= resolution_) { i = resolution_ - 1; }
+        const float interpolation = position - static_cast<float>(i);
+        return samples_[i] + interpolation * (samples_[i + 1] - samples_[i]);
+      }
 
-        if (xHere < x) { low = mid + 1; }
-        else if (xHere > x) { high = mid - 1; }
-        else { return points[mid].y; }
+      void evaluate(const float* in, float* out, size_t size) const {
+        simd::evaluate(samples_, resolution_, in, out, size);
       }
 
-      size_t i = (high > 0) ? high : 0;
+      float getMaximum() const {
+        return *std::max_element(samples_, samples_ + resolution_ + 1);
+      }
+
+      size_t getResolution() const { return resolution_; }
+      const float* getSamples() const { return samples_; }
+
+    private:
+      const float* samples_;
+      size_t resolution_;
+  };
+
+  /** Bake a SplineFunction into a lookup table, see Spline::Baked. */
+  inline Baked Bake(const SplineFunction& spline, size_t resolution = 256) {
+    return Baked(spline, resolution);
+  }
+
+  /** An upper bound of the values that a SplineFunction returns.
+   *
+   * Exact for Curves, Baked curves and Tables.  Other functions are opaque, so for
+   * them this returns 1, the highest score a Consideration can have.
+   */
+  inline float maximum(const SplineFunction& spline) {
+    if (const Curve* curve = curveOf(spline)) {
+      return curve->getMaximum();
+    }
+    if (const Baked* baked = spline.target<Baked>()) {
+      return baked->getMaximum();
+    }
+    if (const Table* table = spline.target<Table>()) {
+      return table->getMaximum();
+    }
+    return 1.f;
+  }
 
-      float diff = x - points[i].x;
-      float diffSq = diff * diff;
-      return points[i].y + coefficients1[i] * diff + coefficients2[i] * diffSq + coefficients3[i] * diff * diffSq;
-    };
+  /** Evaluate any SplineFunction for size inputs.
+   *
+   * Curves, Baked curves and Tables are evaluated with the SIMD kernels,
+   * other functions one value at a time.
+   */
+  inline void evaluate(const SplineFunction& spline, const float* in, float* out, size_t size) {
+    if (const Curve* curve = curveOf(spline)) {
+      curve->evaluate(in, out, size);
+      return;
+    }
+    if (const Baked* baked = spline.target<Baked>()) {
+      baked->evaluate(in, out, size);
+      return;
+    }
+    if (const Table* table = spline.target<Table>()) {
+      table->evaluate(in, out, size);
+      return;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = spline(in[i]);
+    }
   }
 }
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+/** Batch evaluation kernels for Spline::Curve.
+ *
+ * Each kernel evaluates one spline for an array of inputs.  The kernels are
+ * written once against a small set of lane operations, and instantiated for
+ * AVX (8 lanes), SSE2 (4 lanes) and plain floats (1 lane, used for the tail
+ * of an array and on other architectures).  They perform the same
+ * comparisons and the same arithmetic, in the same order, as the scalar
+ * operator() of Spline::Curve, Spline::Baked and Spline::Table, so a lane
+ * computes exactly what a scalar call would have returned.
+ */
+namespace Spline {
+  namespace simd {
+    struct Lanes1 {
+      using type = float;
+      using mask = bool;
+      static constexpr size_t width = 1;
+
+      static type load(const float* p) { return *p; }
+      static void store(float* p, type v) { *p = v; }
+      static type set(float v) { return v; }
+      static type add(type a, type b) { return a + b; }
+      static type sub(type a, type b) { return a - b; }
+      static type mul(type a, type b) { return a * b; }
+      static type div(type a, type b) { return a / b; }
+      static type min(type a, type b) { return a < b ? a : b; }
+      static type truncate(type a) { return static_cast<float>(static_cast<int32_t>(a)); }
+      static type gather(const float* p, type i) { return p[static_cast<size_t>(i)]; }
+      static mask lt(type a, type b) { return a < b; }
+      static mask le(type a, type b) { return a <= b; }
+      static mask ge(type a, type b) { return a >= b; }
+      static mask eq(type a, type b) { return a == b; }
+      static mask unordered(type a) { return a != a; }
+      static mask none() { return false; }
+      static mask both(mask a, mask b) { return a && b; }
+      static mask either(mask a, mask b) { return a || b; }
+      static mask butNot(mask a, mask b) { return a && !b; }
+      static bool all(mask m) { return m; }
+      static type select(mask m, type a, type b) { return m ? a : b; }
+    };
+
+#if defined(__SSE2__)
+    struct Lanes4 {
+      using type = __m128;
+      using mask = __m128;
+      static constexpr size_t width = 4;
+
+      static type load(const float* p) { return _mm_loadu_ps(p); }
+      static void store(float* p, type v) { _mm_storeu_ps(p, v); }
+      static type set(float v) { return _mm_set1_ps(v); }
+      static type add(type a, type b) { return _mm_add_ps(a, b); }
+      static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+      static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+      static type div(type a, type b) { return _mm_div_ps(a, b); }
+      static type min(type a, type b) { return _mm_min_ps(a, b); }
+      static type truncate(type a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a)); }
+      static type gather(const float* p, type i) {
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_cvttps_epi32(i));
+        return _mm_setr_ps(p[lanes[0]], p[lanes[1]], p[lanes[2]], p[lanes[3]]);
+      }
+      static mask lt(type a, type b) { return _mm_cmplt_ps(a, b); }
+      static mask le(type a, type b) { return _mm_cmple_ps(a, b); }
+      static mask ge(type a, type b) { return _mm_cmpge_ps(a, b); }
+      static mask eq(type a, type b) { return _mm_cmpeq_ps(a, b); }
+      static mask unordered(type a) { return _mm_cmpunord_ps(a, a); }
+      static mask none() { return _mm_setzero_ps(); }
+      static mask both(mask a, mask b) { return _mm_and_ps(a, b); }
+      static mask either(mask a, mask b) { return _mm_or_ps(a, b); }
+      static mask butNot(mask a, mask b) { return _mm_andnot_ps(b, a); }
+      static bool all(mask m) { return _mm_movemask_ps(m) == 0xf; }
+      static type select(mask m, type a, type b) {
+        return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+      }
+    };
+#endif
+
+#if defined(__AVX__)
+    struct Lanes8 {
+      using type = __m256;
+      using mask = __m256;
+      static constexpr size_t width = 8;
+
+      static type load(const float* p) { return _mm256_loadu_ps(p); }
+      static void store(float* p, type v) { _mm256_storeu_ps(p, v); }
+      static type set(float v) { return _mm256_set1_ps(v); }
+      static type add(type a, type b) { return _mm256_add_ps(a, b); }
+      static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+      static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+      static type div(type a, type b) { return _mm256_div_ps(a, b); }
+      static type min(type a, type b) { return _mm256_min_ps(a, b); }
+      static type truncate(type a) { return _mm256_cvtepi32_ps(_mm256_cvttps_epi32(a)); }
+#if defined(__AVX2__)
+      static type gather(const float* p, type i) {
+        return _mm256_i32gather_ps(p, _mm256_cvttps_epi32(i), 4);
+      }
+#else
+      static type gather(const float* p, type i) {
+        alignas(32) int32_t lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_cvttps_epi32(i));
+        return _mm256_setr_ps(p[lanes[0]], p[lanes[1]], p[lanes[2]], p[lanes[3]],
+            p[lanes[4]], p[lanes[5]], p[lanes[6]], p[lanes[7]]);
+      }
+#endif
+      static mask lt(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+      static mask le(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+      static mask ge(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+      static mask eq(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+      static mask unordered(type a) { return _mm256_cmp_ps(a, a, _CMP_UNORD_Q); }
+      static mask none() { return _mm256_setzero_ps(); }
+      static mask both(mask a, mask b) { return _mm256_and_ps(a, b); }
+      static mask either(mask a, mask b) { return _mm256_or_ps(a, b); }
+      static mask butNot(mask a, mask b) { return _mm256_andnot_ps(b, a); }
+      static bool all(mask m) { return _mm256_movemask_ps(m) == 0xff; }
+      static type select(mask m, type a, type b) { return _mm256_blendv_ps(b, a, m); }
+    };
+    using Widest = Lanes8;
+#elif defined(__SSE2__)
+    using Widest = Lanes4;
+#else
+    using Widest = Lanes1;
+#endif
+
+    /** Shapes of the piecewise curves that share the segment scan. */
+    enum class Segment { Linear, StepBefore, StepAfter };
+
+    /** Clamp at the first and last control point, as the scalar code does
+     *  before it starts looking for a segment. */
+    template<class V>
+    inline typename V::type clamp(const float* xs, const float* ys, size_t n,
+        typename V::type x, typename V::type y)
+    {
+      y = V::select(V::ge(x, V::set(xs[n - 1])), V::set(ys[n - 1]), y);
+      return V::select(V::le(x, V::set(xs[0])), V::set(ys[0]), y);
+    }
+
+    /** Linear, StepBefore and StepAfter: the first segment [a, b] that
+     *  contains x decides the value, otherwise the last point does. */
+    template<class V, Segment S>
+    inline typename V::type segments(const float* xs, const float* ys, size_t n,
+        typename V::type x)
+    {
+      typename V::type y = V::set(ys[n - 1]);
+      typename V::mask done = V::none();
+      for (size_t i = 0; i + 1 < n && !V::all(done); ++i) {
+        typename V::type ax = V::set(xs[i]);
+        typename V::type bx = V::set(xs[i + 1]);
+        typename V::mask hit = V::butNot(V::both(V::ge(x, ax), V::le(x, bx)), done);
+        typename V::type value;
+        if (S == Segment::Linear) {
+          typename V::type interpolation = V::div(V::sub(x, ax), V::sub(bx, ax));
+          value = V::add(
+              V::mul(V::sub(V::set(1.f), interpolation), V::set(ys[i])),
+              V::mul(interpolation, V::set(ys[i + 1])));
+        } else {
+          value = V::set(S == Segment::StepBefore ? ys[i + 1] : ys[i]);
+        }
+        y = V::select(hit, value, y);
+        done = V::either(done, hit);
+      }
+      return clamp<V>(xs, ys, n, x, y);
+    }
+
+    /** Monotone cubic: x selects the last segment whose start lies left of
+     *  it; an exact hit on a control point returns that point. */
+    template<class V>
+    inline typename V::type monotone(const float* xs, const float* ys, size_t n,
+        const float* c1, const float* c2, const float* c3, typename V::type x)
+    {
+      const size_t count = n - 1;
+      typename V::type px = V::set(xs[0]);
+      typename V::type py = V::set(ys[0]);
+      typename V::type k1 = V::set(c1[0]);
+      typename V::type k2 = V::set(c2[0]);
+      typename V::type k3 = V::set(c3[0]);
+      typename V::mask exact = V::eq(x, px);
+      typename V::type exact_y = py;
+      for (size_t i = 1; i < count; ++i) {
+        typename V::type xi = V::set(xs[i]);
+        typename V::mask right = V::lt(xi, x);
+        px = V::select(right, xi, px);
+        py = V::select(right, V::set(ys[i]), py);
+        k1 = V::select(right, V::set(c1[i]), k1);
+        k2 = V::select(right, V::set(c2[i]), k2);
+        k3 = V::select(right, V::set(c3[i]), k3);
+        typename V::mask hit = V::eq(x, xi);
+        exact = V::either(exact, hit);
+        exact_y = V::select(hit, V::set(ys[i]), exact_y);
+      }
+      typename V::type diff = V::sub(x, px);
+      typename V::type diffSq = V::mul(diff, diff);
+      typename V::type y = V::add(V::add(V::add(py, V::mul(k1, diff)),
+            V::mul(k2, diffSq)), V::mul(V::mul(k3, diff), diffSq));
+      y = V::select(exact, exact_y, y);
+      // The scalar binary search treats NaN as a hit on its first probe.
+      y = V::select(V::unordered(x), V::set(ys[(count - 1) / 2]), y);
+      return clamp<V>(xs, ys, n, x, y);
+    }
+
+    /** A table of resolution + 1 evenly spaced samples over [0, 1].
+     *
+     * Inputs outside (0, 1), and NaN, look up the first cell and are then
+     * replaced by the first or last sample, so every lane reads within the
+     * table.  Indices are computed in floats, which is exact for any
+     * resolution below 2^24.
+     */
+    template<class V>
+    inline typename V::type table(const float* samples, size_t resolution,
+        typename V::type x)
+    {
+      const typename V::type zero = V::set(0.f);
+      const typename V::type one = V::set(1.f);
+      const typename V::mask above_zero = V::lt(zero, x);
+      const typename V::mask inside = V::both(above_zero, V::lt(x, one));
+      typename V::type position = V::mul(V::select(inside, x, zero),
+          V::set(static_cast<float>(resolution)));
+      typename V::type i = V::min(V::truncate(position),
+          V::set(static_cast<float>(resolution - 1)));
+      typename V::type interpolation = V::sub(position, i);
+      typename V::type a = V::gather(samples, i);
+      typename V::type b = V::gather(samples + 1, i);
+      typename V::type y = V::add(a, V::mul(interpolation, V::sub(b, a)));
+      y = V::select(V::ge(x, one), V::set(samples[resolution]), y);
+      return V::select(above_zero, y, V::set(samples[0]));
+    }
+
+    template<class V, Segment S>
+    inline size_t evaluateSegments(const float* xs, const float* ys, size_t n,
+        const float* in, float* out, size_t size)
+    {
+      size_t i = 0;
+      for (; i + V::width <= size; i += V::width) {
+        V::store(out + i, segments<V, S>(xs, ys, n, V::load(in + i)));
+      }
+      return i;
+    }
+
+    template<class V>
+    inline size_t evaluateMonotone(const float* xs, const float* ys, size_t n,
+        const float* c1, const float* c2, const float* c3,
+        const float* in, float* out, size_t size)
+    {
+      size_t i = 0;
+      for (; i + V::width <= size; i += V::width) {
+        V::store(out + i, monotone<V>(xs, ys, n, c1, c2, c3, V::load(in + i)));
+      }
+      return i;
+    }
+
+    template<class V>
+    inline size_t evaluateTable(const float* samples, size_t resolution,
+        const float* in, float* out, size_t size)
+    {
+      size_t i = 0;
+      for (; i + V::width <= size; i += V::width) {
+        V::store(out + i, table<V>(samples, resolution, V::load(in + i)));
+      }
+      return i;
+    }
+
+    /** Evaluate a piecewise curve with the widest available lanes. */
+    template<Segment S>
+    inline void evaluate(const float* xs, const float* ys, size_t n,
+        const float* in, float* out, size_t size)
+    {
+      size_t done = evaluateSegments<Widest, S>(xs, ys, n, in, out, size);
+      evaluateSegments<Lanes1, S>(xs, ys, n, in + done, out + done, size - done);
+    }
+
+    /** Evaluate a monotone cubic curve with the widest available lanes. */
+    inline void evaluate(const float* xs, const float* ys, size_t n,
+        const float* c1, const float* c2, const float* c3,
+        const float* in, float* out, size_t size)
+    {
+      size_t done = evaluateMonotone<Widest>(xs, ys, n, c1, c2, c3, in, out, size);
+      evaluateMonotone<Lanes1>(xs, ys, n, c1, c2, c3, in + done, out + done, size - done);
+    }
+
+    /** Evaluate a sampled table with the widest available lanes. */
+    inline void evaluate(const float* samples, size_t resolution,
+        const float* in, float* out, size_t size)
+    {
+      size_t done = evaluateTable<Widest>(samples, resolution, in, out, size);
+      evaluateTable<Lanes1>(samples, resolution, in + done, out + done, size - done);
+    }
+  }
+}
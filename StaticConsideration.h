@@ -0,0 +1,147 @@
+#pragma once
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "Consideration.h"
+#include "Decision.h"
+
+/** A Consideration whose input and curve are known at compile time.
+ *
+ * Consideration keeps its utilityFunction and spline in std::functions, so
+ * every Consideration::computeScore makes two indirect calls.  A
+ * StaticConsideration stores the lambda and the curve by value instead, so
+ * the compiler can inline the input, scale(), the spline and clip() into a
+ * single expression.  It converts to a regular Consideration wherever one
+ * is expected, which is what happens inside `considerations {...}`.  To
+ * keep the static types, collect them with static_considerations(...).
+ */
+template<class Input, class Curve>
+class StaticConsideration {
+  public:
+    StaticConsideration(const std::string& description,
+        Input input,
+        Curve curve,
+        range input_range)
+      : description_(description),
+      input_(input),
+      curve_(curve),
+      min_(std::get<0>(input_range)),
+      max_(std::get<1>(input_range))
+    {}
+
+    inline float computeScore() const
+    {
+      return clip(curve_(scale(input_(), min_, max_)));
+    }
+
+    operator Consideration() const {
+      return Consideration(description_, input_, curve_, range(min_, max_));
+    }
+
+  private:
+    std::string description_;
+    // The consideration() macro creates mutable lambdas.
+    mutable Input input_;
+    Curve curve_;
+    float min_;
+    float max_;
+};
+
+template<class Input, class Curve>
+StaticConsideration<Input, Curve> makeConsideration(const std::string& description,
+    Input input,
+    Curve curve,
+    range input_range)
+{
+  return StaticConsideration<Input, Curve>(description, input, curve, input_range);
+}
+
+namespace detail {
+  /** Unrolls Decision::computeScore(threshold) over a tuple of
+   *  StaticConsiderations.
+   *
+   * The upper bounds and the profile are those of decision, whose
+   * Considerations are copies of the same ones.
+   */
+  template<size_t I, size_t N>
+  struct StaticScore {
+    template<class Tuple>
+    static inline float compute(const Tuple& considerations, const Decision& decision,
+        float total_score, float modification_factor, float threshold)
+    {
+      const float bound = total_score * decision.upper_bounds_[I];
+      if (bound <= threshold) {
+        decision.profileExit(I);
+        return bound;
+      }
+      float score;
+      {
+        BEHAVIOR_ENGINE_PROFILE_SCOPE(decision.considerations_[I].getProfile());
+        score = std::get<I>(considerations).computeScore();
+      }
+      total_score *= Decision::weigh(score, modification_factor);
+      if (total_score < 1e-6f) {
+        decision.profileExit(I + 1);
+        return total_score;
+      }
+      return StaticScore<I + 1, N>::compute(considerations, decision, total_score,
+          modification_factor, threshold);
+    }
+
+    template<class Tuple>
+    static void collect(const Tuple& considerations, std::vector<Consideration>& out) {
+      out.emplace_back(std::get<I>(considerations));
+      StaticScore<I + 1, N>::collect(considerations, out);
+    }
+  };
+
+  template<size_t N>
+  struct StaticScore<N, N> {
+    template<class Tuple>
+    static inline float compute(const Tuple&, const Decision&, float total_score, float, float) {
+      return total_score;
+    }
+
+    template<class Tuple>
+    static void collect(const Tuple&, std::vector<Consideration>&) {}
+  };
+}
+
+/** A fixed list of StaticConsiderations, scored without indirect calls.
+ *
+ * Passing this instead of `considerations {...}` to
+ * DecisionEngine::addDecision gives the Decision a scorer in which all
+ * Considerations are inlined.
+ */
+template<class... Cs>
+class StaticConsiderations {
+  public:
+    explicit StaticConsiderations(const Cs&... cs)
+      : considerations_(cs...)
+    {}
+
+    /** Same as Decision::computeScore(threshold), for a Decision made
+     *  from these. */
+    inline float computeScore(const Decision& decision, float threshold) const {
+      const float modification_factor = 1.f - (1.f / float(sizeof...(Cs)));
+      return detail::StaticScore<0, sizeof...(Cs)>::compute(considerations_, decision,
+          static_cast<float>(decision.getUtility()), modification_factor, threshold);
+    }
+
+    operator std::vector<Consideration>() const {
+      std::vector<Consideration> out;
+      out.reserve(sizeof...(Cs));
+      detail::StaticScore<0, sizeof...(Cs)>::collect(considerations_, out);
+      return out;
+    }
+
+  private:
+    std::tuple<Cs...> considerations_;
+};
+
+template<class... Cs>
+StaticConsiderations<Cs...> static_considerations(const Cs&... cs) {
+  return StaticConsiderations<Cs...>(cs...);
+}
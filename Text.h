@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+/** An immutable string that copies share.
+ *
+ * Decisions and Considerations keep their names and descriptions as Text.
+ * A RuleSetBuilder interns them: all Texts with the same contents then
+ * refer to a single string in its string table.
+ */
+class Text {
+  public:
+    Text() = default;
+    Text(const std::string& text) : text_(std::make_shared<const std::string>(text)) {}
+    explicit Text(std::shared_ptr<const std::string> text) : text_(std::move(text)) {}
+
+    const std::string& str() const {
+      static const std::string empty;
+      return text_ ? *text_ : empty;
+    }
+
+  private:
+    std::shared_ptr<const std::string> text_;
+};
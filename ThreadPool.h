@@ -0,0 +1,217 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Exceptions.h"
+
+/** A fixed set of worker threads that run the iterations of a loop.
+ *
+ * parallelFor hands out the iterations one at a time to the workers and to
+ * the calling thread, and returns when all of them are done.  forEachThread
+ * runs a task once on every thread instead, for callers that schedule the
+ * work themselves, like TickScheduler.  One loop runs at a time; a pool
+ * can be shared by several DecisionEngines, which then take turns.
+ *
+ * A loop that is started from within a loop of the same pool, like a
+ * DecisionEngine that scores on the pool of the TickScheduler that ticks
+ * it, runs on the calling thread alone instead of waiting for its turn.
+ * Waking the workers costs in the order of ten microseconds, so this only
+ * pays off when the iterations are expensive.
+ */
+class ThreadPool {
+  public:
+    /** Start workers.  By default, one less than the number of cores, as
+     *  the calling thread takes part in every loop. */
+    explicit ThreadPool(size_t workers = defaultWorkers()) {
+      threads_.reserve(workers);
+      for (size_t i = 0; i < workers; ++i) {
+        threads_.emplace_back([this, i]() { work(i + 1); });
+      }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+      }
+      wake_.notify_all();
+      for (auto& thread : threads_) {
+        thread.join();
+      }
+    }
+
+    /** Number of worker threads, not counting the calling thread. */
+    size_t size() const { return threads_.size(); }
+
+    /** Call task(i) for every i below count.
+     *
+     * The calls are spread over the workers and the calling thread.  If any
+     * call throws, the first exception is rethrown here after all other
+     * calls have finished.  This does not allocate.
+     */
+    template<class F>
+    void parallelFor(size_t count, F& task) {
+      if (threads_.empty() || count < 2 || current() == this) {
+        for (size_t i = 0; i < count; ++i) {
+          task(i);
+        }
+        return;
+      }
+      start(task, count, false);
+    }
+
+    /** Call task(thread) once on every thread.
+     *
+     * thread is 0 on the calling thread and 1 up to size() on the workers,
+     * and a worker always gets the same number.  Exceptions are handled as
+     * in parallelFor.  Within a loop of this pool, it only calls task(0).
+     */
+    template<class F>
+    void forEachThread(F& task) {
+      if (threads_.empty() || current() == this) {
+        task(size_t(0));
+        return;
+      }
+      start(task, threads_.size() + 1, true);
+    }
+
+    static size_t defaultWorkers() {
+      const unsigned int cores = std::thread::hardware_concurrency();
+      return cores > 1 ? cores - 1 : 0;
+    }
+
+  private:
+    std::vector<std::thread> threads_;
+    /** Taken for the duration of a loop, so loops run one at a time. */
+    std::mutex turn_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stopping_ = false;
+    unsigned long generation_ = 0;
+    size_t busy_ = 0;
+    std::exception_ptr error_;
+
+    // The current loop, set under mutex_ before generation_ is raised.
+    void (*invoke_)(void*, size_t) = nullptr;
+    void* context_ = nullptr;
+    size_t count_ = 0;
+    bool per_thread_ = false;
+    std::atomic<size_t> next_{0};
+
+    /** The pool whose loop the current thread runs, if any. */
+    static const ThreadPool*& current() {
+      static thread_local const ThreadPool* pool = nullptr;
+      return pool;
+    }
+
+    /** Marks the current thread as running a loop of a pool. */
+    class Inside {
+      public:
+        explicit Inside(const ThreadPool* pool) : outer_(current()) { current() = pool; }
+        ~Inside() { current() = outer_; }
+
+        Inside(const Inside&) = delete;
+        Inside& operator=(const Inside&) = delete;
+
+      private:
+        const ThreadPool* outer_;
+    };
+
+    template<class F>
+    static void call(void* task, size_t i) {
+      (*static_cast<F*>(task))(i);
+    }
+
+    /** Run a loop on all threads, and wait for it to finish. */
+    template<class F>
+    void start(F& task, size_t count, bool per_thread) {
+      std::lock_guard<std::mutex> turn(turn_);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        invoke_ = &call<F>;
+        context_ = &task;
+        count_ = count;
+        per_thread_ = per_thread;
+        next_.store(0, std::memory_order_relaxed);
+        busy_ = threads_.size();
+        error_ = nullptr;
+        ++generation_;
+      }
+      wake_.notify_all();
+      run(0);
+      std::exception_ptr error;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return busy_ == 0; });
+        error = error_;
+        error_ = nullptr;
+      }
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+
+    /** Take iterations until there are none left. */
+    void run(size_t thread) {
+      if (per_thread_) {
+        invoke(thread);
+        return;
+      }
+      for (;;) {
+        const size_t i = next_.fetch_add(1, std::memory_order_relaxed);
+        if (i >= count_) {
+          return;
+        }
+        invoke(i);
+      }
+    }
+
+    void invoke(size_t i) {
+      Inside inside(this);
+#if BEHAVIOR_ENGINE_EXCEPTIONS
+      try {
+        invoke_(context_, i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+      }
+#else
+      invoke_(context_, i);
+#endif
+    }
+
+    void work(size_t thread) {
+      unsigned long seen = 0;
+      for (;;) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          wake_.wait(lock, [this, seen]() { return stopping_ || generation_ != seen; });
+          if (stopping_) {
+            return;
+          }
+          seen = generation_;
+        }
+        run(thread);
+        bool last;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          last = --busy_ == 0;
+        }
+        if (last) {
+          done_.notify_one();
+        }
+      }
+    }
+};
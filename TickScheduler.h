@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "DecisionEngine.h"
+#include "ThreadPool.h"
+
+/** Ticks many DecisionEngines at once on a work-stealing ThreadPool.
+ *
+ * Every tick() runs executeBestDecision on all engines and returns when
+ * they are done, so it doubles as the barrier at the end of a frame.  Each
+ * thread of the pool has its own queue of engines.  Engines with an
+ * affinity hint go to the queue of that thread; the others are spread so
+ * that the queues get about the same cost, as measured in the previous
+ * frame.  A thread whose queue runs dry takes engines from the back of the
+ * other queues, so a few heavy rule sets do not leave the other cores
+ * idle.
+ *
+ * The engines of one scheduler should not share mutable state, as they are
+ * ticked at the same time.  An engine may score on the same ThreadPool,
+ * see DecisionEngine::setThreadPool, but within a tick it then scores on
+ * the thread that ticks it: the threads are busy with the other engines.
+ */
+class TickScheduler {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /** Passed as affinity to let the scheduler choose the thread. */
+    static constexpr size_t ANY_THREAD = std::numeric_limits<size_t>::max();
+
+    /** What happened to an engine in the last tick(). */
+    enum class Outcome {
+      /** Not ticked yet. */
+      Idle,
+      /** Its best Decision was executed. */
+      Executed,
+      /** Nothing was loaded or activated, see DecisionEngine::tryGetBestDecision. */
+      NoDecision,
+      /** It threw an exception, which tick() rethrows. */
+      Failed,
+    };
+
+    explicit TickScheduler(std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>())
+      : pool_(pool),
+      queues_(pool->size() + 1)
+    {}
+
+    /** Number of threads that tick engines, including the calling one. */
+    size_t threads() const { return queues_.size(); }
+
+    size_t size() const { return entries_.size(); }
+
+    /** Add an engine, which should outlive the scheduler.
+     *
+     * Returns its index.  affinity is a hint: the engine is queued on that
+     * thread (modulo threads()), but it may still be stolen by another.
+     */
+    size_t add(DecisionEngine& engine, size_t affinity = ANY_THREAD) {
+      entries_.emplace_back();
+      entries_.back().engine = &engine;
+      entries_.back().affinity = affinity;
+      order_.push_back(entries_.size() - 1);
+      for (auto& queue : queues_) {
+        queue.items.resize(entries_.size());
+      }
+      return entries_.size() - 1;
+    }
+
+    void setAffinity(size_t index, size_t affinity) {
+      entries_[index].affinity = affinity;
+    }
+
+    void clear() {
+      entries_.clear();
+      order_.clear();
+    }
+
+    /** Select and execute the best Decision of every engine.
+     *
+     * Returns when all engines are done.  If an engine threw, the first
+     * exception, in the order the engines were added, is rethrown
+     * afterwards.
+     */
+    void tick() {
+      distribute();
+      auto work = [this](size_t thread) { run(thread); };
+      pool_->forEachThread(work);
+      std::exception_ptr error;
+      for (auto& entry : entries_) {
+        if (entry.error && !error) {
+          error = entry.error;
+        }
+        entry.error = nullptr;
+      }
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+
+    Outcome getOutcome(size_t index) const { return entries_[index].outcome; }
+
+    /** The thread that ticked an engine last. */
+    size_t getThread(size_t index) const { return entries_[index].thread; }
+
+    /** How long the last tick of an engine took. */
+    Clock::duration getCost(size_t index) const { return entries_[index].cost; }
+
+  private:
+    struct Entry {
+      DecisionEngine* engine = nullptr;
+      size_t affinity = ANY_THREAD;
+      Outcome outcome = Outcome::Idle;
+      size_t thread = 0;
+      Clock::duration cost = Clock::duration::zero();
+      std::exception_ptr error;
+    };
+
+    /** A deque of engine indices: the owner pops at the front, thieves at
+     *  the back. */
+    struct Queue {
+      std::mutex mutex;
+      std::vector<size_t> items;
+      size_t head = 0;
+      size_t tail = 0;
+      Clock::duration load = Clock::duration::zero();
+    };
+
+    std::shared_ptr<ThreadPool> pool_;
+    std::vector<Queue> queues_;
+    std::vector<Entry> entries_;
+    /** Engine indices, sorted on their cost before every tick. */
+    std::vector<size_t> order_;
+
+    /** Fill the queues for the next tick. */
+    void distribute() {
+      for (auto& queue : queues_) {
+        queue.head = 0;
+        queue.tail = 0;
+        queue.load = Clock::duration::zero();
+      }
+      // Place the most expensive engines first, each on the queue that has
+      // the least work so far.
+      std::sort(order_.begin(), order_.end(), [this](size_t x, size_t y) {
+          return entries_[x].cost > entries_[y].cost;
+          });
+      for (size_t index : order_) {
+        Entry& entry = entries_[index];
+        size_t target = 0;
+        if (entry.affinity != ANY_THREAD) {
+          target = entry.affinity % queues_.size();
+        } else {
+          for (size_t q = 1; q < queues_.size(); ++q) {
+            if (queues_[q].load < queues_[target].load) {
+              target = q;
+            }
+          }
+        }
+        Queue& queue = queues_[target];
+        queue.items[queue.tail++] = index;
+        queue.load += std::max(entry.cost, Clock::duration(1));
+      }
+    }
+
+    bool pop(size_t thread, size_t& index) {
+      Queue& queue = queues_[thread];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.head == queue.tail) {
+        return false;
+      }
+      index = queue.items[queue.head++];
+      return true;
+    }
+
+    bool steal(size_t thread, size_t& index) {
+      for (size_t offset = 1; offset < queues_.size(); ++offset) {
+        Queue& queue = queues_[(thread + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.head != queue.tail) {
+          index = queue.items[--queue.tail];
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /** Work on one thread until all queues are empty. */
+    void run(size_t thread) {
+      size_t index;
+      while (pop(thread, index) || steal(thread, index)) {
+        Entry& entry = entries_[index];
+        const Clock::time_point start = Clock::now();
+        entry.error = nullptr;
+#if BEHAVIOR_ENGINE_EXCEPTIONS
+        try {
+#endif
+          entry.outcome = entry.engine->tryExecuteBestDecision()
+            ? Outcome::Executed : Outcome::NoDecision;
+#if BEHAVIOR_ENGINE_EXCEPTIONS
+        } catch (...) {
+          entry.outcome = Outcome::Failed;
+          entry.error = std::current_exception();
+        }
+#endif
+        entry.cost = Clock::now() - start;
+        entry.thread = thread;
+      }
+    }
+};
@@ -0,0 +1,463 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BatchDecisionEngine.h"
+#include "DecisionEngine.h"
+#include "InputReplay.h"
+#include "RuleFile.h"
+#include "RuleSetBuilder.h"
+#include "TickScheduler.h"
+
+/** The benchmark has no meaningful events; they are numbered 0..n-1. */
+enum class Event : unsigned int {};
+
+/** Counts every heap allocation made by the process.
+ *
+ * Every form of operator new and delete is replaced, so that all of them
+ * allocate with malloc() and release with free().  free() is called from
+ * a function that is not inlined, or g++ pairs it with the operator new of
+ * the caller and warns about a mismatch.
+ */
+static std::atomic<unsigned long> allocation_count(0);
+
+static void* countedAllocate(std::size_t size) noexcept {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+
+[[gnu::noinline]] static void release(void* p) noexcept {
+  std::free(p);
+}
+
+void* operator new(std::size_t size) {
+  if (void* p = countedAllocate(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  if (void* p = countedAllocate(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return countedAllocate(size);
+}
+
+void operator delete(void* p) noexcept {
+  release(p);
+}
+
+void operator delete[](void* p) noexcept {
+  release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  release(p);
+}
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  enum class SplineKind {
+    Linear,
+    StepBefore,
+    StepAfter,
+    Monotone,
+    Mixed
+  };
+
+  struct Options {
+    unsigned int events = 4;
+    unsigned int decisions = 8;
+    unsigned int considerations = 3;
+    unsigned int points = 4;
+    unsigned int ticks = 100000;
+    unsigned int agents = 0;
+    unsigned int bake = 0;
+    unsigned int adaptive = 0;
+    unsigned int snapshots = 0;
+    unsigned int threads = 0;
+    unsigned int seed = 42;
+    unsigned int builder = 0;
+    unsigned int engines = 0;
+    SplineKind spline = SplineKind::Mixed;
+    std::string record;
+    std::string tape;
+    std::string rules;
+  };
+
+  /** Input signals read by the synthetic Considerations.
+   *
+   * They are refreshed every tick, so scores differ from tick to tick and
+   * the engine cannot settle on a single Decision.
+   */
+  std::vector<float> inputs;
+
+  void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+      << "  --events N          number of events (default 4)\n"
+      << "  --decisions N       decisions per event (default 8)\n"
+      << "  --considerations N  considerations per decision (default 3)\n"
+      << "  --points N          control points per spline (default 4)\n"
+      << "  --spline KIND       linear, stepbefore, stepafter, monotone or mixed\n"
+      << "  --ticks N           number of getBestDecision calls (default 100000)\n"
+      << "  --agents N          also tick a BatchDecisionEngine with N agents\n"
+      << "  --bake N            bake all splines into tables of N samples\n"
+      << "  --adaptive N        reorder considerations every N scorings\n"
+      << "  --snapshots N       cache up to N active sets (default 0, disabled)\n"
+      << "  --threads N         score each tier on a pool of N worker threads\n"
+      << "  --seed N            seed of the rule set generator (default 42)\n"
+      << "  --builder N         1 builds the rule set with a RuleSetBuilder\n"
+      << "  --engines N         also tick N engines with a TickScheduler\n"
+      << "  --record PATH       record every tick into a flight recorder file\n"
+      << "  --tape PATH         record the inputs into a tape, and time its replay\n"
+      << "  --rules PATH        load the rules from a rule file, whose inputs are named\n"
+      << "                      input0, input1, ..., its events event0, event1, ...\n"
+      << "                      and its actions noop\n";
+  }
+
+  bool parse(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc) {
+        return false;
+      }
+      std::string value = argv[++i];
+      if (arg == "--spline") {
+        if (value == "linear") options.spline = SplineKind::Linear;
+        else if (value == "stepbefore") options.spline = SplineKind::StepBefore;
+        else if (value == "stepafter") options.spline = SplineKind::StepAfter;
+        else if (value == "monotone") options.spline = SplineKind::Monotone;
+        else if (value == "mixed") options.spline = SplineKind::Mixed;
+        else return false;
+        continue;
+      }
+      if (arg == "--record") {
+        options.record = value;
+        continue;
+      }
+      if (arg == "--tape") {
+        options.tape = value;
+        continue;
+      }
+      if (arg == "--rules") {
+        options.rules = value;
+        continue;
+      }
+      unsigned int number = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+      if (arg == "--events") options.events = number;
+      else if (arg == "--decisions") options.decisions = number;
+      else if (arg == "--considerations") options.considerations = number;
+      else if (arg == "--points") options.points = number;
+      else if (arg == "--ticks") options.ticks = number;
+      else if (arg == "--agents") options.agents = number;
+      else if (arg == "--bake") options.bake = number;
+      else if (arg == "--adaptive") options.adaptive = number;
+      else if (arg == "--snapshots") options.snapshots = number;
+      else if (arg == "--threads") options.threads = number;
+      else if (arg == "--seed") options.seed = number;
+      else if (arg == "--builder") options.builder = number;
+      else if (arg == "--engines") options.engines = number;
+      else return false;
+    }
+    return options.events > 0 && options.decisions > 0
+      && options.considerations > 0 && options.points > 1 && options.ticks > 0;
+  }
+
+  /** Random control points with strictly increasing x over [0, 1]. */
+  std::vector<Spline::P2> makePoints(std::mt19937& generator, unsigned int count) {
+    std::uniform_real_distribution<float> y(0.f, 1.f);
+    std::vector<Spline::P2> points(count);
+    for (unsigned int i = 0; i < count; ++i) {
+      points[i] = {static_cast<float>(i) / static_cast<float>(count - 1), y(generator)};
+    }
+    return points;
+  }
+
+  Spline::SplineFunction makeSpline(std::mt19937& generator, SplineKind kind, unsigned int count) {
+    if (kind == SplineKind::Mixed) {
+      kind = static_cast<SplineKind>(generator() % 4);
+    }
+    std::vector<Spline::P2> points = makePoints(generator, count);
+    switch (kind) {
+      case SplineKind::StepBefore: return Spline::StepBefore(points);
+      case SplineKind::StepAfter: return Spline::StepAfter(points);
+      case SplineKind::Monotone: return Spline::Monotone(points);
+      case SplineKind::Linear:
+      case SplineKind::Mixed:
+        break;
+    }
+    return Spline::Linear(points);
+  }
+
+  /** Fill the engine with events * decisions synthetic Decisions.
+   *
+   * Consideration k reads the input created by input(k).
+   */
+  template<class Engine>
+  void generate(Engine& engine, const Options& options,
+      const std::function<UtilityFunction(size_t)>& input)
+  {
+    std::mt19937 generator(options.seed);
+    size_t slot = 0;
+    for (unsigned int e = 0; e < options.events; ++e) {
+      for (unsigned int d = 0; d < options.decisions; ++d) {
+        considerations c;
+        for (unsigned int k = 0; k < options.considerations; ++k, ++slot) {
+          c.emplace_back(description("Synthetic input"),
+              input(slot),
+              makeSpline(generator, options.spline, options.points),
+              range(0, 1));
+        }
+        engine.addDecision(
+            name(("Decision " + std::to_string(e) + "." + std::to_string(d)).c_str()),
+            description("Synthetic decision"),
+            static_cast<UtilityScore>(1 + generator() % 4),
+            events {static_cast<Event>(e)},
+            c,
+            [](Decision&) {});
+      }
+    }
+  }
+
+  /** Cheap xorshift, so refreshing the inputs does not dominate a tick. */
+  void refreshInputs(unsigned int& state, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      inputs[i] = static_cast<float>(state & 0xffffff) / static_cast<float>(0xffffff);
+    }
+  }
+
+  double nanoseconds(Clock::duration d) {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  }
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parse(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const size_t slots = options.events * options.decisions * options.considerations;
+  inputs.assign(slots * std::max(options.agents, 1u), 0.f);
+
+  DecisionEngine engine;
+  auto input = [](size_t slot) -> UtilityFunction {
+    return [slot]() { return inputs[slot]; };
+  };
+  const unsigned long before_building = allocation_count.load(std::memory_order_relaxed);
+  const Clock::time_point start_building = Clock::now();
+  if (!options.rules.empty()) {
+    RuleBindings bindings;
+    for (size_t slot = 0; slot < slots; ++slot) {
+      engine.addInput("input" + std::to_string(slot), input(slot));
+    }
+    for (unsigned int e = 0; e < options.events; ++e) {
+      bindings.events_by_name["event" + std::to_string(e)] = static_cast<Event>(e);
+    }
+    bindings.actions_by_name["noop"] = [](Decision&) {};
+    RuleFile file(options.rules);
+    engine.publish(file.load(engine, bindings));
+    engine.adoptRules();
+  } else if (options.builder > 0) {
+    RuleSetBuilder builder(options.events * options.decisions, slots, slots * options.points);
+    generate(builder, options, input);
+    engine.publish(builder.build());
+    engine.adoptRules();
+  } else {
+    generate(engine, options, input);
+  }
+  const Clock::duration building = Clock::now() - start_building;
+  const unsigned long building_allocations =
+    allocation_count.load(std::memory_order_relaxed) - before_building;
+  engine.setAdaptiveOrdering(options.adaptive);
+  engine.setSnapshotLimit(options.snapshots);
+  if (options.threads > 0) {
+    engine.setThreadPool(std::make_shared<ThreadPool>(options.threads));
+  }
+  if (!options.record.empty()) {
+    engine.setFlightRecorder(std::make_shared<FlightRecorder>(options.record));
+  }
+  if (options.bake > 0) {
+    std::cout << "baked splines, max error: " << engine.bakeSplines(options.bake) << "\n";
+  }
+  for (unsigned int e = 0; e < options.events; ++e) {
+    engine.raiseEvent(static_cast<Event>(e));
+  }
+
+  // Scoring: the inputs are refreshed outside of the timed region.
+  unsigned int state = options.seed | 1;
+  unsigned long empty = 0;
+  unsigned long allocations = 0;
+  Clock::duration scoring(0);
+  for (unsigned int t = 0; t < options.ticks; ++t) {
+    refreshInputs(state, slots);
+    unsigned long before = allocation_count.load(std::memory_order_relaxed);
+    Clock::time_point start = Clock::now();
+    if (!engine.tryGetBestDecision()) {
+      ++empty;
+    }
+    scoring += Clock::now() - start;
+    allocations += allocation_count.load(std::memory_order_relaxed) - before;
+  }
+
+  // Event churn: every event is cleared and raised again.
+  unsigned long churn_allocations = 0;
+  Clock::duration raising(0);
+  Clock::duration clearing(0);
+  const unsigned int rounds = options.ticks / options.events + 1;
+  for (unsigned int r = 0; r < rounds; ++r) {
+    Event e = static_cast<Event>(r % options.events);
+    unsigned long before = allocation_count.load(std::memory_order_relaxed);
+    Clock::time_point start = Clock::now();
+    engine.clearEvent(e);
+    Clock::time_point middle = Clock::now();
+    engine.raiseEvent(e);
+    raising += Clock::now() - middle;
+    clearing += middle - start;
+    churn_allocations += allocation_count.load(std::memory_order_relaxed) - before;
+  }
+
+  const double ticks = options.ticks;
+  std::cout << "events: " << options.events
+    << ", decisions/event: " << options.decisions
+    << ", considerations/decision: " << options.considerations
+    << ", points/spline: " << options.points << "\n"
+    << (!options.rules.empty() ? "RuleFile:          "
+        : options.builder > 0 ? "RuleSetBuilder:    " : "addDecision:       ")
+    << nanoseconds(building) / 1e6 << " ms, "
+    << building_allocations << " allocations\n"
+    << "getBestDecision:   " << nanoseconds(scoring) / ticks << " ns/call, "
+    << static_cast<double>(allocations) / ticks << " allocations/tick, "
+    << empty << " empty ticks\n"
+    << "raiseEvent:        " << nanoseconds(raising) / rounds << " ns/call\n"
+    << "clearEvent:        " << nanoseconds(clearing) / rounds << " ns/call\n"
+    << "raise+clear:       " << static_cast<double>(churn_allocations) / rounds
+    << " allocations/round\n";
+
+  if (options.agents > 0) {
+    BatchDecisionEngine batch(options.agents);
+    generate(batch, options, [&batch, slots](size_t slot) -> UtilityFunction {
+        return [&batch, slots, slot]() { return inputs[batch.getAgent() * slots + slot]; };
+      });
+    for (size_t decision = 0; options.bake > 0 && decision < batch.getDecisionCount(); ++decision) {
+      batch.getDecision(decision).bake(options.bake);
+    }
+    for (unsigned int agent = 0; agent < options.agents; ++agent) {
+      for (unsigned int e = 0; e < options.events; ++e) {
+        batch.raiseEvent(agent, static_cast<Event>(e));
+      }
+    }
+    const unsigned int batch_ticks = std::max(options.ticks / options.agents, 1u);
+    Clock::duration batch_scoring(0);
+    unsigned long batch_allocations = 0;
+    for (unsigned int t = 0; t < batch_ticks; ++t) {
+      refreshInputs(state, inputs.size());
+      unsigned long before = allocation_count.load(std::memory_order_relaxed);
+      Clock::time_point start = Clock::now();
+      batch.getBestDecisions();
+      batch_scoring += Clock::now() - start;
+      batch_allocations += allocation_count.load(std::memory_order_relaxed) - before;
+    }
+    std::cout << "getBestDecisions:  " << nanoseconds(batch_scoring) / batch_ticks << " ns/call, "
+      << nanoseconds(batch_scoring) / batch_ticks / options.agents << " ns/agent, "
+      << static_cast<double>(batch_allocations) / batch_ticks << " allocations/tick ("
+      << options.agents << " agents)\n";
+  }
+
+  if (options.engines > 0) {
+    // The engines share the inputs, which they only read.
+    std::vector<std::unique_ptr<DecisionEngine>> engines;
+    TickScheduler scheduler(options.threads > 0
+        ? std::make_shared<ThreadPool>(options.threads)
+        : std::make_shared<ThreadPool>());
+    for (unsigned int i = 0; i < options.engines; ++i) {
+      engines.emplace_back(new DecisionEngine());
+      generate(*engines.back(), options, input);
+      for (unsigned int e = 0; e < options.events; ++e) {
+        engines.back()->raiseEvent(static_cast<Event>(e));
+      }
+      scheduler.add(*engines.back());
+    }
+    const unsigned int scheduler_ticks = std::max(options.ticks / options.engines, 1u);
+    Clock::duration scheduling(0);
+    unsigned long executed = 0;
+    for (unsigned int t = 0; t < scheduler_ticks; ++t) {
+      refreshInputs(state, slots);
+      Clock::time_point start = Clock::now();
+      scheduler.tick();
+      scheduling += Clock::now() - start;
+      for (size_t i = 0; i < scheduler.size(); ++i) {
+        executed += scheduler.getOutcome(i) == TickScheduler::Outcome::Executed;
+      }
+    }
+    std::cout << "TickScheduler:     " << nanoseconds(scheduling) / scheduler_ticks << " ns/tick, "
+      << nanoseconds(scheduling) / scheduler_ticks / options.engines << " ns/engine, "
+      << static_cast<double>(executed) / scheduler_ticks << " executed/tick ("
+      << options.engines << " engines, " << scheduler.threads() << " threads)\n";
+  }
+
+  if (!options.tape.empty()) {
+    std::shared_ptr<InputRecorder> recorder = std::make_shared<InputRecorder>(options.tape);
+    engine.setInputRecorder(recorder);
+    Clock::duration recording(0);
+    for (unsigned int t = 0; t < options.ticks; ++t) {
+      refreshInputs(state, slots);
+      Clock::time_point start = Clock::now();
+      engine.tryGetBestDecision();
+      recording += Clock::now() - start;
+    }
+    engine.setInputRecorder(nullptr);
+    recorder->flush();
+
+    // The replay replaces the UtilityFunctions, so it comes last.
+    InputReplay replay(options.tape);
+    replay.attach(engine);
+    Clock::duration replaying(0);
+    for (;;) {
+      Clock::time_point start = Clock::now();
+      if (!replay.next(engine)) {
+        break;
+      }
+      engine.tryGetBestDecision();
+      replaying += Clock::now() - start;
+    }
+    const double replayed = static_cast<double>(std::max(replay.getTicks(), 1ul));
+    std::cout << "InputRecorder:     " << nanoseconds(recording) / ticks << " ns/tick, "
+      << recorder->size() << " inputs\n"
+      << "InputReplay:       " << nanoseconds(replaying) / replayed << " ns/tick, "
+      << replay.getTicks() << " ticks\n";
+  }
+  return 0;
+}
@@ -4,7 +4,8 @@
  * This library provides a graphical editor and viewer for this C++
  * DecisionEngine's collection of Decisions.  It can read in a file with
  * calls to DecisionEngine::addDecision, render this graphically, and generate
- * an edited list of calls to DecisionEngine::addDecision.
+ * an edited list of calls to DecisionEngine::addDecision, or a binary rule
+ * file that RuleFile.h loads without recompiling.
  *
  * Each of the types involved in adding a decision to a DecisionEngine have
  * a correspondingly named type in this library.  Each of these types have
@@ -12,6 +13,9 @@
  *   - toCpp(), which generates a string that is a partial C++ expression that
  *     represents this object.
  *   - toHtml(), which generates a HTML representation of this object.
+ * Intelligence.toRuleFile() writes the rule file with a RuleFileWriter, and
+ * Intelligence.toBakedCpp() writes C++ in which every spline is a constexpr
+ * table (see Spline::Table) and every Decision uses static_considerations.
  *
  * NOTE: There is no direct link to the C++ code; any changes in the C++ API
  * will require manual changes in this Javascript library.
@@ -134,6 +138,42 @@ class Intelligence
     return out;
   }
 
+  /**
+   * C++ like toCpp(), but with every spline sampled into a constexpr table
+   * of resolution + 1 values, so nothing is built at runtime and the
+   * compiler can inline the whole score of a Decision.  The result is meant
+   * for the build, not to be read back in.
+   */
+  toBakedCpp(resolution = 256) {
+    let tables = '';
+    let decisions = '';
+    for (let decision of this.decisions) {
+      let tableNames = new Map();
+      for (let consideration of decision.considerations) {
+        let tableName = cppIdentifier('spline ' + decision.name.name + ' ' + consideration.description.description);
+        while (tables.indexOf(' ' + tableName + '[]') !== -1) {
+          tableName += '_';
+        }
+        // Nine significant digits identify a float exactly.
+        let samples = consideration.spline.sample(resolution).map(function (value) {
+          return numberToCppString(Number(value.toPrecision(9)));
+        });
+        tables += 'static constexpr float ' + tableName + '[] = {' + samples.join(', ') + '};\n';
+        tableNames.set(consideration, tableName);
+      }
+      decisions += decision.toCpp(tableNames) + '\n';
+    }
+    return tables + '\n' + decisions;
+  }
+
+  toRuleFile() {
+    let writer = new RuleFileWriter();
+    for (let decision of this.decisions) {
+      writer.addDecision(decision);
+    }
+    return writer.toArrayBuffer();
+  }
+
   addEmptyDecision() {
     this.decisions.unshift(new Decision(this.decisionId++, emptyDecisionCpp));
     $('#decision_container').prepend(this.decisions[0].toHtml());
@@ -505,16 +545,23 @@ class Decision
     return out;
   }
 
-  toCpp() {
-    let cppConsiderations = this.considerations.map(function(x){ return x.toCpp(); });
+  /**
+   * tableNames optionally maps Considerations to the name of the table of
+   * their spline; the Considerations are then static_considerations.
+   */
+  toCpp(tableNames) {
+    let cppConsiderations = this.considerations.map(function(x){
+      return x.toCpp(tableNames && tableNames.get(x));
+    });
+    let baked = tableNames !== undefined && this.considerations.length > 0;
     return 'addDecision(\n'
       + this.name.toCpp() + ',\n'
       + this.description.toCpp() + ',\n'
       + this.utility.toCpp() + ',\n'
       + this.events.toCpp() + ',\n'
-      + 'considerations {\n'
+      + (baked ? 'static_considerations(\n' : 'considerations {\n')
       + cppConsiderations.join(',\n')
-      + '},\n'
+      + (baked ? '),\n' : '},\n')
       + this.action.toCpp()
       + ');\n';
   }
@@ -713,23 +760,44 @@ class Spline {
     window.sessionStorage.setItem(this.id + ',points', JSON.stringify(this.points));
   }
   
-  pointsToCpp() {
+  normalizedPoints() {
     let width = window.sessionStorage.getItem(this.id + ',width');
     let height = window.sessionStorage.getItem(this.id + ',height');
     
-    let point_strings = [];
+    let points = [];
     let editor_points = JSON.parse(window.sessionStorage.getItem(this.id + ',points'));
     for (let point of editor_points) {
       // Transform coordinate system from SVG's (0,width) x (0,height)
       // to (0,1) x (0,1)
-      let x = point[0] / width;
-      let y = (height - point[1]) / height;
-      point_strings.push('{' + numberToCppString(x) + ', ' + numberToCppString(y) + '}');
+      points.push([point[0] / width, (height - point[1]) / height]);
     }
+    return points;
+  }
+
+  pointsToCpp() {
+    let point_strings = this.normalizedPoints().map(function (point) {
+      return '{' + numberToCppString(point[0]) + ', ' + numberToCppString(point[1]) + '}';
+    });
     return '{' + point_strings.join(', ') + '}';
   }
 
-  toCpp() {
+  /**
+   * Values at resolution + 1 evenly spaced inputs over [0, 1], as the C++
+   * Spline::Curve of this interpolation computes them.
+   */
+  sample(resolution) {
+    let curve = new CurveSampler(this.interpolation, this.normalizedPoints());
+    let samples = [];
+    for (let i = 0; i <= resolution; ++i) {
+      samples.push(curve.evaluate(i / resolution));
+    }
+    return samples;
+  }
+
+  toCpp(tableName) {
+    if (tableName !== undefined) {
+      return 'Spline::Table(' + tableName + ')';
+    }
     return 'Spline::' + this.interpolation + '('
       + this.pointsToCpp()
       + ')';
@@ -746,6 +814,81 @@ class Spline {
   }
 }
 
+/**
+ * Javascript port of C++'s Spline::Curve, to sample splines for export.
+ *
+ * Keep it in sync with Spline.h.
+ */
+class CurveSampler
+{
+  constructor(interpolation, points) {
+    this.interpolation = interpolation;
+    this.xs = points.map(function (p) { return p[0]; });
+    this.ys = points.map(function (p) { return p[1]; });
+    if (interpolation === 'Monotone' && points.length > 1) {
+      this.computeMonotoneCoefficients();
+    }
+  }
+
+  evaluate(x) {
+    let xs = this.xs;
+    let ys = this.ys;
+    if (xs.length === 0) {
+      return 0;
+    }
+    if (x <= xs[0]) { return ys[0]; }
+    if (x >= xs[xs.length - 1]) { return ys[ys.length - 1]; }
+    let i = 0;
+    while (!(x >= xs[i] && x <= xs[i + 1])) {
+      ++i;
+    }
+    let diff = x - xs[i];
+    switch (this.interpolation) {
+      case 'StepBefore': return ys[i + 1];
+      case 'StepAfter': return ys[i];
+      case 'Monotone':
+        if (x === xs[i + 1]) {
+          return ys[i + 1];
+        }
+        return ys[i] + this.c1[i] * diff + this.c2[i] * diff * diff + this.c3[i] * diff * diff * diff;
+    }
+    let interpolation = diff / (xs[i + 1] - xs[i]);
+    return (1 - interpolation) * ys[i] + interpolation * ys[i + 1];
+  }
+
+  computeMonotoneCoefficients() {
+    let xs = this.xs;
+    let ys = this.ys;
+    let count = xs.length - 1;
+    let deltaXs = [];
+    let slopes = [];
+    for (let i = 0; i < count; ++i) {
+      deltaXs.push(xs[i + 1] - xs[i]);
+      slopes.push((ys[i + 1] - ys[i]) / deltaXs[i]);
+    }
+    this.c1 = [slopes[0]];
+    for (let i = 0; i < count - 1; ++i) {
+      let slope = slopes[i];
+      let slopeNext = slopes[i + 1];
+      if (slope * slopeNext <= 0) {
+        this.c1.push(0);
+      } else {
+        let common = deltaXs[i] + deltaXs[i + 1];
+        this.c1.push(3 * common / ((common + deltaXs[i + 1]) / slope + (common + deltaXs[i]) / slopeNext));
+      }
+    }
+    this.c1.push(slopes[count - 1]);
+    this.c2 = [];
+    this.c3 = [];
+    for (let i = 0; i < count; ++i) {
+      let invDx = 1 / deltaXs[i];
+      let common = this.c1[i] + this.c1[i + 1] - 2 * slopes[i];
+      this.c2.push((slopes[i] - this.c1[i] - common) * invDx);
+      this.c3.push(common * invDx * invDx);
+    }
+  }
+}
+
 /**
  * Wrapper for C++'s Consideration type.
  *
@@ -793,11 +936,11 @@ class Consideration
     return out;
   }
 
-  toCpp() {
+  toCpp(tableName) {
     return 'consideration(\n'
       + this.description.toCpp() + ',\n'
       + this.range.toCpp() + ',\n'
-      + this.spline.toCpp() + ',\n'
+      + this.spline.toCpp(tableName) + ',\n'
       + this.utilityFunction.toCpp() + '\n'
       + ')';
   }
@@ -811,6 +954,188 @@ class Consideration
   }
 }
 
+/**
+ * Writer of the binary rule file that RuleFile.h loads.
+ *
+ * Keep the layout in sync with namespace rulefile in RuleFile.h.  A rule
+ * file cannot hold C++ code, so it refers to everything by name:
+ *   - a UtilityFunction should be the name of an input channel, as passed to
+ *     DecisionEngine::addInput.  Quotes around it are dropped.
+ *   - an Action is bound by its text if that is a plain name, and by the
+ *     name of its Decision otherwise.
+ *   - Events by their name, as listed in Events.valid.
+ */
+class RuleFileWriter
+{
+  static get version() { return 1; }
+
+  static get splineKinds() {
+    return {
+      'Linear': 0,
+      'StepBefore': 1,
+      'StepAfter': 2,
+      'Monotone': 3
+    };
+  }
+
+  constructor() {
+    this.decisions = [];
+    this.considerations = [];
+    this.points = [];
+    this.events = [];
+    this.strings = [];
+    this.stringOffsets = new Map();
+    this.stringsSize = 0;
+    this.encoder = new TextEncoder();
+  }
+
+  // Offset of a NUL-terminated string in the string table.
+  string(text) {
+    if (!this.stringOffsets.has(text)) {
+      let bytes = this.encoder.encode(text);
+      this.stringOffsets.set(text, this.stringsSize);
+      this.strings.push(bytes);
+      this.stringsSize += bytes.length + 1;
+    }
+    return this.stringOffsets.get(text);
+  }
+
+  addDecision(decision) {
+    let name = decision.name.name;
+    let action = decision.action.cppCode;
+    let record = {
+      name: this.string(name),
+      description: this.string(decision.description.description),
+      action: this.string(/^[A-Za-z_]\w*$/.test(action) ? action : name),
+      utility: UtilityScore.valid[decision.utility.score],
+      firstEvent: this.events.length,
+      eventCount: decision.events.events.length,
+      firstConsideration: this.considerations.length,
+      considerationCount: decision.considerations.length
+    };
+    for (let event of decision.events.events) {
+      this.events.push(this.string(event));
+    }
+    for (let consideration of decision.considerations) {
+      this.addConsideration(name, consideration);
+    }
+    this.decisions.push(record);
+  }
+
+  addConsideration(decisionName, consideration) {
+    let description = consideration.description.description;
+    let input = consideration.utilityFunction.cppCode.replace(/^(["'])(.*)\1$/, '$2');
+    if (input === '' || /[;(){}]/.test(input)) {
+      throw new Error('Consideration "' + description + '" of "' + decisionName
+        + '" should name an input channel');
+    }
+    let min = parseFloat(consideration.range.minRange);
+    let max = parseFloat(consideration.range.maxRange);
+    if (!isFinite(min) || !isFinite(max) || !(Math.fround(min) < Math.fround(max))) {
+      throw new Error('Consideration "' + description + '" of "' + decisionName
+        + '" should have a numeric range with min < max');
+    }
+    let points = consideration.spline.normalizedPoints();
+    let spline = RuleFileWriter.splineKinds[consideration.spline.interpolation];
+    if (points.length < 1) {
+      throw new Error('Consideration "' + description + '" of "' + decisionName
+        + '" needs at least one spline point');
+    }
+    // The file holds floats, so compare the xs as floats.
+    for (let i = 1; i < points.length; ++i) {
+      if (!(Math.fround(points[i - 1][0]) < Math.fround(points[i][0]))) {
+        throw new Error('Consideration "' + description + '" of "' + decisionName
+          + '" needs spline points with increasing x');
+      }
+    }
+    this.considerations.push({
+      description: this.string(description),
+      input: this.string(input),
+      min: min,
+      max: max,
+      spline: spline,
+      firstPoint: this.points.length,
+      pointCount: points.length
+    });
+    this.points.push(...points);
+  }
+
+  toArrayBuffer() {
+    const headerSize = 48;
+    const decisionSize = 32;
+    const considerationSize = 32;
+    const pointSize = 8;
+    const eventSize = 4;
+    let decisionsOffset = headerSize;
+    let considerationsOffset = decisionsOffset + this.decisions.length * decisionSize;
+    let pointsOffset = considerationsOffset + this.considerations.length * considerationSize;
+    let eventsOffset = pointsOffset + this.points.length * pointSize;
+    let stringsOffset = eventsOffset + this.events.length * eventSize;
+    // The string table is never empty, so that it ends in a NUL.
+    let stringsSize = Math.max(this.stringsSize, 1);
+    let size = Math.ceil((stringsOffset + stringsSize) / 4) * 4;
+
+    let buffer = new ArrayBuffer(size);
+    let view = new DataView(buffer);
+    let offset = 0;
+    let u32 = function (value) { view.setUint32(offset, value, true); offset += 4; };
+    let i32 = function (value) { view.setInt32(offset, value, true); offset += 4; };
+    let f32 = function (value) { view.setFloat32(offset, value, true); offset += 4; };
+
+    u32(0x53524542); // "BERS"
+    u32(RuleFileWriter.version);
+    u32(this.decisions.length);
+    u32(decisionsOffset);
+    u32(this.considerations.length);
+    u32(considerationsOffset);
+    u32(this.points.length);
+    u32(pointsOffset);
+    u32(this.events.length);
+    u32(eventsOffset);
+    u32(stringsSize);
+    u32(stringsOffset);
+    for (let d of this.decisions) {
+      u32(d.name);
+      u32(d.description);
+      u32(d.action);
+      i32(d.utility);
+      u32(d.firstEvent);
+      u32(d.eventCount);
+      u32(d.firstConsideration);
+      u32(d.considerationCount);
+    }
+    for (let c of this.considerations) {
+      u32(c.description);
+      u32(c.input);
+      f32(c.min);
+      f32(c.max);
+      u32(c.spline);
+      u32(c.firstPoint);
+      u32(c.pointCount);
+      u32(0);
+    }
+    for (let p of this.points) {
+      f32(p[0]);
+      f32(p[1]);
+    }
+    for (let e of this.events) {
+      u32(e);
+    }
+    let bytes = new Uint8Array(buffer, stringsOffset);
+    let position = 0;
+    for (let s of this.strings) {
+      bytes.set(s, position);
+      position += s.length + 1;
+    }
+    return buffer;
+  }
+}
+
+function cppIdentifier(text) {
+  let identifier = text.trim().replace(/\W+/g, '_').toLowerCase();
+  return /^\d/.test(identifier) ? '_' + identifier : identifier;
+}
+
 function numberToCppString(number) {
   return number.toString() + (Number.isInteger(number) ? '.f' : 'f');
 }
@@ -986,6 +1311,13 @@ function downloadHeaderFile(content, fileName) {
   window.URL.revokeObjectURL(textFile);
 }
 
+function downloadRuleFile(buffer, fileName) {
+  let data = new File([buffer], fileName, {type: 'application/octet-stream'});
+  let ruleFile = window.URL.createObjectURL(data);
+  window.open(ruleFile);
+  window.URL.revokeObjectURL(ruleFile);
+}
+
 $(function() {
   let mouseLastHoverSection = 'decisions_section';
   let splineHovered = null;
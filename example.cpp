@@ -65,14 +65,16 @@ Test::Test() : DecisionEngine() {
     UtilityScore::MostUseful,
     events {Event::Always},
 
-    considerations {
+    // static_considerations instead of considerations lets the compiler
+    // inline the Considerations into the scoring of this Decision.
+    static_considerations(
       consideration(
         description("Randomness"), 
         range(0, 1),
         Spline::Linear({{0,0}, {1,1}}), {
           return getRandom();
-        }),
-    },
+        })
+    ),
 
     actions {
       report("Executed " + std::to_string(++counter) + " times");
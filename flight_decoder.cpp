@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "FlightRecorder.h"
+
+/** Prints the ticks in a file written by FlightRecorder, oldest first.
+ *
+ * Every line holds the tick number, the time since the oldest tick, the
+ * raised Events as a bit mask, the chosen Decision with its score, and
+ * every scored Decision as handle:name=score, or as handle:name pruned<=t
+ * if its scoring stopped because it could not beat t.  Flags: S means some
+ * Events are missing from the mask, T that not all scores were kept, and I
+ * that the search stopped at a deadline.
+ */
+namespace {
+  void usage(const char* program) {
+    std::cerr << "Usage: " << program << " FILE [--last N]\n";
+  }
+
+  template<class T>
+  const T& at(const std::vector<char>& data, uint64_t offset) {
+    return *reinterpret_cast<const T*>(data.data() + offset);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2 && !(argc == 4 && std::string(argv[2]) == "--last")) {
+    usage(argv[0]);
+    return 1;
+  }
+  std::ifstream file(argv[1], std::ios::binary);
+  if (!file) {
+    std::cerr << "Cannot open " << argv[1] << "\n";
+    return 1;
+  }
+  const std::vector<char> data((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(flight::Header)) {
+    std::cerr << argv[1] << " is not a flight recorder file\n";
+    return 1;
+  }
+  const flight::Header& header = at<flight::Header>(data, 0);
+  if (header.magic != flight::MAGIC) {
+    std::cerr << argv[1] << " is not a flight recorder file\n";
+    return 1;
+  }
+  if (header.version != flight::VERSION) {
+    std::cerr << argv[1] << " has version " << header.version
+      << ", expected " << flight::VERSION << "\n";
+    return 1;
+  }
+  if (header.slot_count == 0
+      || header.names_offset + header.names_size > data.size()
+      || header.slots_offset + uint64_t(header.slot_count) * header.slot_size > data.size()) {
+    std::cerr << argv[1] << " is truncated\n";
+    return 1;
+  }
+
+  std::vector<std::string> names;
+  for (uint64_t i = 0; i < header.names_size; ) {
+    const char* name = data.data() + header.names_offset + i;
+    names.push_back(name);
+    i += names.back().size() + 1;
+  }
+
+  // The ring holds the last slot_count ticks, minus any that were being
+  // written when the file was last synced.
+  const uint64_t last = header.ticks;
+  uint64_t first = last > header.slot_count ? last - header.slot_count + 1 : 1;
+  if (argc == 4) {
+    const uint64_t count = std::strtoull(argv[3], nullptr, 10);
+    if (last >= count && last - count + 1 > first) {
+      first = last - count + 1;
+    }
+  }
+  int64_t start = 0;
+  for (uint64_t tick = first; tick <= last; ++tick) {
+    const uint64_t offset = header.slots_offset
+      + (tick - 1) % header.slot_count * header.slot_size;
+    const flight::Slot& slot = at<flight::Slot>(data, offset);
+    if (slot.tick != tick) {
+      continue;
+    }
+    if (start == 0) {
+      start = slot.timestamp;
+    }
+    auto name = [&names](uint32_t decision) {
+      return decision < names.size() ? names[decision] : std::string("?");
+    };
+    std::cout << "tick " << tick
+      << " +" << std::fixed << std::setprecision(3)
+      << static_cast<double>(slot.timestamp - start) / 1e6 << "ms"
+      << " events 0x" << std::hex << slot.event_mask << std::dec
+      << (slot.flags & flight::SPARSE_EVENTS ? " S" : "")
+      << (slot.flags & flight::TRUNCATED ? " T" : "")
+      << (slot.flags & flight::INCOMPLETE ? " I" : "")
+      << " chosen ";
+    if (slot.chosen == flight::NO_DECISION) {
+      std::cout << "none";
+    } else {
+      std::cout << slot.chosen << ":" << name(slot.chosen)
+        << "=" << std::setprecision(4) << slot.best_score;
+    }
+    std::cout << " |";
+    const uint32_t count = std::min(slot.count, header.max_decisions);
+    for (uint32_t i = 0; i < count; ++i) {
+      const flight::Entry& entry = at<flight::Entry>(data,
+          offset + sizeof(flight::Slot) + i * sizeof(flight::Entry));
+      const uint32_t decision = entry.decision & ~flight::PRUNED;
+      std::cout << " " << decision << ":" << name(decision)
+        << (entry.decision & flight::PRUNED ? " pruned<=" : "=")
+        << std::setprecision(4) << entry.score;
+    }
+    std::cout << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,423 @@
+// Assertions on the file formats and the selection modes of the engine.
+// Built as behavior_engine_checks, and run by ctest.
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+enum class Event : unsigned int {
+  Always,
+  Kickoff
+};
+
+#include "DecisionEngine.h"
+#include "FlightRecorder.h"
+#include "InputRecorder.h"
+#include "InputReplay.h"
+#include "RuleFile.h"
+
+namespace {
+  /** Add a Decision that scores its utility times input, for input in
+   *  [0, 1].  Returns its handle. */
+  DecisionHandle addLinear(DecisionEngine& engine, const char* decision_name,
+      UtilityScore utility, const events& e, const float& input)
+  {
+    engine.addDecision(name(decision_name), description("Linear"), utility, e,
+        considerations {
+          consideration(description("Input"), range(0, 1),
+            Spline::Linear({{0, 0}, {1, 1}}), { return input; }),
+        },
+        [](Decision&) {});
+    return engine.getRuleSet().getDecisionCount() - 1;
+  }
+
+  std::vector<char> readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  template<class T>
+  T readAt(const std::vector<char>& file, uint64_t offset) {
+    assert(offset + sizeof(T) <= file.size());
+    T value;
+    std::memcpy(&value, file.data() + offset, sizeof(T));
+    return value;
+  }
+
+  template<class E, class F>
+  bool throws(F f) {
+    try {
+      f();
+    } catch (const E&) {
+      return true;
+    }
+    return false;
+  }
+
+  float kick = 0.f;
+  float pass = 0.f;
+  float dribble = 0.f;
+  float distance = 0.f;
+  float rank_inputs[5] = {};
+
+  void checkFlightRecorder() {
+    const std::string path = "behavior_engine_checks.flight";
+    assert(throws<std::invalid_argument>([] { FlightRecorder("behavior_engine_checks.flight", 0); }));
+    assert(throws<std::invalid_argument>([] { FlightRecorder("behavior_engine_checks.flight", 4, 0); }));
+
+    DecisionEngine engine;
+    const DecisionHandle kick_handle = addLinear(engine, "Kick", UtilityScore::MostUseful, events {Event::Always}, kick);
+    const DecisionHandle pass_handle = addLinear(engine, "Pass", UtilityScore::MostUseful, events {Event::Always}, pass);
+    addLinear(engine, "Dribble", UtilityScore::Useful, events {Event::Always}, dribble);
+    engine.raiseEvent(Event::Always);
+    engine.setFlightRecorder(std::make_shared<FlightRecorder>(path, 4, 8));
+
+    // Kick sets the score to beat, so Pass is pruned, and Dribble cannot
+    // get there and is not scored at all.
+    kick = 0.75f;
+    pass = 0.5f;
+    dribble = 1.f;
+    assert(engine.tryGetBestDecision().handle == kick_handle);
+    kick = 0.f;
+    pass = 0.f;
+    dribble = 0.f;
+    assert(!engine.tryGetBestDecision());
+    engine.setFlightRecorder(nullptr);
+
+    const std::vector<char> file = readFile(path);
+    const flight::Header header = readAt<flight::Header>(file, 0);
+    assert(header.magic == flight::MAGIC);
+    assert(header.version == flight::VERSION);
+    assert(header.slot_count == 4);
+    assert(header.max_decisions == 8);
+    assert(header.ticks == 2);
+    assert(std::string(file.data() + header.names_offset, header.names_size)
+        == std::string("Kick\0Pass\0Dribble\0", 18));
+
+    const uint64_t first = header.slots_offset;  // Tick 1
+    const flight::Slot slot = readAt<flight::Slot>(file, first);
+    assert(slot.tick == 1);
+    assert(slot.event_mask == 1);
+    assert(slot.chosen == kick_handle);
+    assert(slot.best_score == 4.f * 0.75f);
+    assert(slot.count == 2);
+    assert(slot.flags == 0);
+    const flight::Entry scored = readAt<flight::Entry>(file, first + sizeof(flight::Slot));
+    assert(scored.decision == kick_handle);
+    assert(scored.score == 4.f * 0.75f);
+    const flight::Entry pruned = readAt<flight::Entry>(file, first + sizeof(flight::Slot) + sizeof(flight::Entry));
+    assert(pruned.decision == (pass_handle | flight::PRUNED));
+    assert(pruned.score == 4.f * 0.75f);
+
+    const flight::Slot empty = readAt<flight::Slot>(file, header.slots_offset + header.slot_size);
+    assert(empty.tick == 2);
+    assert(empty.chosen == flight::NO_DECISION);
+    assert(empty.best_score == 0.f);
+  }
+
+  /** Kick and Dribble read their inputs through a Consideration, Pass
+   *  through a StaticConsideration. */
+  void addTapeRules(DecisionEngine& engine) {
+    addLinear(engine, "Kick", UtilityScore::MostUseful, events {Event::Always}, kick);
+    engine.addDecision(name("Pass"), description("Static"), UtilityScore::MostUseful,
+        events {Event::Always},
+        static_considerations(
+          consideration(description("Input"), range(0, 1),
+            Spline::Linear({{0, 0}, {1, 1}}), { return pass; })),
+        [](Decision&) {});
+    addLinear(engine, "Dribble", UtilityScore::Useful, events {Event::Kickoff}, dribble);
+  }
+
+  void checkInputTape() {
+    const std::string path = "behavior_engine_checks.tape";
+    std::ofstream("behavior_engine_checks.notape") << "not a tape";
+    assert(throws<std::runtime_error>([] { InputReplay("behavior_engine_checks.notape"); }));
+
+    std::vector<SelectionResult> recorded;
+    {
+      DecisionEngine engine;
+      addTapeRules(engine);
+      engine.raiseEvent(Event::Always);
+      engine.setInputRecorder(std::make_shared<InputRecorder>(path));
+      assert(!engine.getDecision(1)->hasScorer());
+      const float inputs[][3] = {{0.75f, 0.5f, 1.f}, {0.25f, 0.5f, 1.f}, {0.f, 0.f, 1.f}};
+      for (const auto& input : inputs) {
+        kick = input[0];
+        pass = input[1];
+        dribble = input[2];
+        if (recorded.size() == 2) {
+          engine.raiseEvent(Event::Kickoff);
+        }
+        recorded.push_back(engine.tryGetBestDecision());
+      }
+      engine.setInputRecorder(nullptr);
+      assert(engine.getDecision(1)->hasScorer());
+    }
+    assert(recorded[0].handle == 0 && recorded[1].handle == 1 && recorded[2].handle == 2);
+
+    // Inputs that would make Kick win every tick, unless they are replaced.
+    kick = 1.f;
+    pass = 0.f;
+    dribble = 0.f;
+    DecisionEngine engine;
+    addTapeRules(engine);
+    InputReplay replay(path);
+    replay.attach(engine);
+    size_t tick = 0;
+    while (replay.next(engine)) {
+      const SelectionResult result = engine.tryGetBestDecision();
+      assert(tick < recorded.size());
+      assert(result.handle == recorded[tick].handle);
+      assert(result.score == recorded[tick].score);
+      ++tick;
+    }
+    assert(tick == recorded.size());
+    assert(replay.getTicks() == recorded.size());
+    assert(replay.getMissing() == 0);
+  }
+
+  /** Write a rule file with a Useful Decision "Shoot" on "always", that
+   *  runs "kick", with one Consideration of the input "distance". */
+  void writeRuleFile(const std::string& path, const std::vector<rulefile::Point>& points,
+      rulefile::SplineKind kind, float min = 0.f, float max = 1.f)
+  {
+    const std::string strings("Shoot\0Far away\0kick\0distance\0always\0", 36);
+    const uint32_t point_count = static_cast<uint32_t>(points.size());
+    rulefile::Header header = {};
+    header.magic = rulefile::MAGIC;
+    header.version = rulefile::VERSION;
+    header.decision_count = 1;
+    header.decisions_offset = sizeof(rulefile::Header);
+    header.consideration_count = 1;
+    header.considerations_offset = header.decisions_offset + sizeof(rulefile::Decision);
+    header.point_count = point_count;
+    header.points_offset = header.considerations_offset + sizeof(rulefile::Consideration);
+    header.event_count = 1;
+    header.events_offset = header.points_offset + point_count * uint32_t(sizeof(rulefile::Point));
+    header.strings_size = static_cast<uint32_t>(strings.size());
+    header.strings_offset = header.events_offset + sizeof(rulefile::EventName);
+    const rulefile::Decision decision = {0, 6, 15, int32_t(UtilityScore::Useful), 0, 1, 0, 1};
+    const rulefile::Consideration curve = {6, 20, min, max, kind, 0, point_count, 0};
+    const rulefile::EventName event = 29;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    tape::put(out, header);
+    tape::put(out, decision);
+    tape::put(out, curve);
+    for (const rulefile::Point& point : points) {
+      tape::put(out, point);
+    }
+    tape::put(out, event);
+    out << strings << std::string((4 - strings.size() % 4) % 4, '\0');
+  }
+
+  /** The score of the Decision in the rule file at path, as loaded. */
+  float scoreRuleFile(const std::string& path, const RuleBindings& bindings) {
+    DecisionEngine engine;
+    engine.addInput("distance", [] { return distance; });
+    RuleFile file(path);
+    assert(file.getDecisionCount() == 1);
+    engine.publish(file.load(engine, bindings));
+    engine.raiseEvent(Event::Always);
+    const SelectionResult result = engine.tryGetBestDecision();
+    assert(result.handle == 0);
+    assert(engine.getDecision(result.handle)->getName() == "Shoot");
+    return result.score;
+  }
+
+  void checkRuleFile() {
+    const std::string path = "behavior_engine_checks.rules";
+    RuleBindings bindings;
+    bindings.events_by_name["always"] = Event::Always;
+    bindings.actions_by_name["kick"] = [](Decision&) {};
+
+    distance = 0.5f;
+    writeRuleFile(path, {{0.f, 0.f}, {1.f, 1.f}}, rulefile::LINEAR, 0.f, 2.f);
+    assert(scoreRuleFile(path, bindings) == 2.f * 0.25f);
+    // A single point makes a constant curve of any kind.
+    for (rulefile::SplineKind kind : {rulefile::LINEAR, rulefile::STEP_BEFORE,
+        rulefile::STEP_AFTER, rulefile::MONOTONE}) {
+      writeRuleFile(path, {{0.25f, 0.75f}}, kind);
+      assert(scoreRuleFile(path, bindings) == 2.f * 0.75f);
+    }
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float infinity = std::numeric_limits<float>::infinity();
+    writeRuleFile(path, {}, rulefile::LINEAR);
+    assert(throws<std::runtime_error>([&path] { RuleFile file(path); }));
+    writeRuleFile(path, {{0.5f, 0.f}, {0.25f, 1.f}}, rulefile::MONOTONE);
+    assert(throws<std::runtime_error>([&path] { RuleFile file(path); }));
+    writeRuleFile(path, {{0.5f, 0.f}, {0.5f, 1.f}}, rulefile::STEP_AFTER);
+    assert(throws<std::runtime_error>([&path] { RuleFile file(path); }));
+    writeRuleFile(path, {{0.f, nan}, {1.f, 1.f}}, rulefile::LINEAR);
+    assert(throws<std::runtime_error>([&path] { RuleFile file(path); }));
+    writeRuleFile(path, {{0.f, 0.f}, {1.f, 1.f}}, rulefile::LINEAR, 1.f, 1.f);
+    assert(throws<std::runtime_error>([&path] { RuleFile file(path); }));
+    writeRuleFile(path, {{0.f, 0.f}, {1.f, 1.f}}, rulefile::LINEAR, 0.f, infinity);
+    assert(throws<std::runtime_error>([&path] { RuleFile file(path); }));
+
+    writeRuleFile(path, {{0.f, 0.f}, {1.f, 1.f}}, rulefile::LINEAR);
+    RuleBindings unbound = bindings;
+    unbound.actions_by_name.clear();
+    assert(throws<std::runtime_error>([&path, &unbound] { scoreRuleFile(path, unbound); }));
+  }
+
+  void checkBestDecision() {
+    DecisionEngine engine;
+    const DecisionHandle kick_handle = addLinear(engine, "Kick", UtilityScore::VeryUseful, events {Event::Always}, kick);
+    const DecisionHandle pass_handle = addLinear(engine, "Pass", UtilityScore::Useful, events {Event::Always}, pass);
+    engine.addDecision(name("Dribble"), description("Half"), UtilityScore::MostUseful,
+        events {Event::Always},
+        considerations {
+          consideration(description("Input"), range(0, 1),
+            Spline::Linear({{0, 0}, {1, 0.5}}), { return dribble; }),
+        },
+        [](Decision&) {});
+    const DecisionHandle dribble_handle = engine.getRuleSet().getDecisionCount() - 1;
+    engine.raiseEvent(Event::Always);
+
+    const RuleSet& rules = engine.getRuleSet();
+    assert(rules.getSummary(kick_handle).utility == 3.f);
+    assert(rules.getSummary(kick_handle).upper_bound == engine.getDecision(kick_handle)->getUpperBound());
+    assert(rules.getSummary(kick_handle).decision == engine.getDecision(kick_handle).get());
+    assert(rules.getSummary(dribble_handle).utility == 4.f);
+    // The bound follows the maximum of the curve, with a little slack.
+    assert(rules.getSummary(dribble_handle).upper_bound >= 2.f);
+    assert(rules.getSummary(dribble_handle).upper_bound < 2.001f);
+
+    // A lower UtilityScore wins with a higher score.
+    kick = 0.25f;
+    pass = 1.f;
+    dribble = 0.5f;
+    SelectionResult result = engine.tryGetBestDecision();
+    assert(result.handle == pass_handle);
+    assert(result.score == 2.f);
+    assert(engine.getBestDecision()->getName() == "Pass");
+    // Of equal scores, the first one scanned wins: higher UtilityScore first.
+    dribble = 1.f;
+    assert(engine.tryGetBestDecision().handle == dribble_handle);
+    kick = 0.f;
+    pass = 0.f;
+    dribble = 0.f;
+    result = engine.tryGetBestDecision();
+    assert(!result);
+    assert(result.reason == SelectionReason::NoPositiveScore);
+
+    // A deadline that passed before the scan stops it before any Decision.
+    pass = 1.f;
+    result = engine.tryGetBestDecision(DecisionEngine::Clock::time_point::min());
+    assert(result.reason == SelectionReason::OutOfTime);
+    assert(!result.complete);
+    const AnytimeSelection selection = engine.getBestDecision(std::chrono::hours(1));
+    assert(selection.complete);
+    assert(selection.decision == engine.getDecision(pass_handle));
+
+    engine.clearActive();
+    assert(engine.tryGetBestDecision().reason == SelectionReason::NoActiveRules);
+  }
+
+  void checkTopDecisions() {
+    DecisionEngine engine;
+    // The first Decision is loaded by both Events, and must be ranked once.
+    addLinear(engine, "A", UtilityScore::Useful, events {Event::Always, Event::Kickoff}, rank_inputs[0]);
+    addLinear(engine, "B", UtilityScore::Useful, events {Event::Always}, rank_inputs[1]);
+    addLinear(engine, "C", UtilityScore::Useful, events {Event::Always}, rank_inputs[2]);
+    addLinear(engine, "D", UtilityScore::Useful, events {Event::Kickoff}, rank_inputs[3]);
+    addLinear(engine, "E", UtilityScore::Useful, events {Event::Always}, rank_inputs[4]);
+    engine.raiseEvent(Event::Always);
+    engine.raiseEvent(Event::Kickoff);
+    const float inputs[] = {0.5f, 0.25f, 1.f, 0.75f, 0.f};
+    std::copy(std::begin(inputs), std::end(inputs), std::begin(rank_inputs));
+
+    std::vector<RankedDecision> ranked;
+    SelectionResult result = engine.tryGetBestDecisions(3, ranked);
+    assert(result.handle == 2);
+    assert(result.score == 2.f);
+    assert(ranked.size() == 3);
+    assert(ranked[0].handle == 2 && ranked[0].score == 2.f);
+    assert(ranked[1].handle == 3 && ranked[1].score == 1.5f);
+    assert(ranked[2].handle == 0 && ranked[2].score == 1.f);
+    // Only Decisions that score above 0, each once.
+    result = engine.tryGetBestDecisions(10, ranked);
+    assert(ranked.size() == 4);
+    assert(ranked[3].handle == 1 && ranked[3].score == 0.5f);
+    // k is at least 1.
+    engine.tryGetBestDecisions(0, ranked);
+    assert(ranked.size() == 1 && ranked[0].handle == 2);
+
+    // Ties are broken like getBestDecision breaks them.
+    std::fill(std::begin(rank_inputs), std::end(rank_inputs), 0.5f);
+    result = engine.tryGetBestDecisions(2, ranked);
+    assert(ranked.size() == 2);
+    assert(ranked[0].score == 1.f && ranked[1].score == 1.f);
+    assert(ranked[0].handle == engine.tryGetBestDecision().handle);
+    assert(result.handle == ranked[0].handle);
+
+    std::fill(std::begin(rank_inputs), std::end(rank_inputs), 0.f);
+    result = engine.tryGetBestDecisions(2, ranked);
+    assert(result.reason == SelectionReason::NoPositiveScore);
+    assert(ranked.empty());
+    engine.clearActive();
+    result = engine.tryGetBestDecisions(2, ranked);
+    assert(result.reason == SelectionReason::NoActiveRules);
+    assert(ranked.empty());
+  }
+
+  void checkWeightedRandom() {
+    DecisionEngine engine;
+    const DecisionHandle kick_handle = addLinear(engine, "Kick", UtilityScore::Useful, events {Event::Always}, kick);
+    const DecisionHandle pass_handle = addLinear(engine, "Pass", UtilityScore::Useful, events {Event::Always}, pass);
+    addLinear(engine, "Dribble", UtilityScore::Useful, events {Event::Always}, dribble);
+    engine.raiseEvent(Event::Always);
+    kick = 1.f;
+    pass = 0.5f;
+    dribble = 0.125f;
+
+    engine.setSelectionMode(SelectionMode::WeightedRandom, 0.f);
+    for (int i = 0; i < 100; ++i) {
+      assert(engine.tryGetBestDecision().handle == kick_handle);
+    }
+
+    // Kick scores 2 and Pass 1, so Kick is picked two times out of three.
+    // Dribble scores 0.25, below 2 minus the margin, and is never picked.
+    engine.setSelectionMode(SelectionMode::WeightedRandom, 1.5f);
+    engine.seedSelection(25);
+    std::vector<DecisionHandle> picks;
+    size_t kicks = 0;
+    for (int i = 0; i < 3000; ++i) {
+      const SelectionResult result = engine.tryGetBestDecision();
+      assert(result.handle == kick_handle || result.handle == pass_handle);
+      assert(result.score == (result.handle == kick_handle ? 2.f : 1.f));
+      kicks += result.handle == kick_handle;
+      picks.push_back(result.handle);
+    }
+    assert(kicks > 1800 && kicks < 2200);
+    // The same seed picks the same Decisions.
+    engine.seedSelection(25);
+    for (DecisionHandle pick : picks) {
+      assert(engine.tryGetBestDecision().handle == pick);
+    }
+
+    kick = 0.f;
+    pass = 0.f;
+    dribble = 0.f;
+    assert(engine.tryGetBestDecision().reason == SelectionReason::NoPositiveScore);
+  }
+}
+
+int main(int, char**) {
+  checkFlightRecorder();
+  checkInputTape();
+  checkRuleFile();
+  checkBestDecision();
+  checkTopDecisions();
+  checkWeightedRandom();
+  std::cout << "All checks passed\n";
+}